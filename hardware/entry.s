@@ -15,18 +15,37 @@
 @@  -----------  -------  -------  ----  ---------------------------------------------------------------------------
 @@  2018-Dec-25  Initial   0.0.1   ADCL  Initial version
 @@  2019-Jun-08  Initial   0.0.1   ADCL  Send the APs to the kernel code as well
+@@  2026-Oct-18  Initial   0.0.1   ADCL  Start the PMU before clearing bss in the profiling build
+@@  2026-Oct-18  Initial   0.0.1   ADCL  Core 1 receives the modules on an early start before joining the kernel
+@@  2026-Oct-18  Initial   0.0.1   ADCL  Add the warm restart stub that kMain() copies to low memory
+@@  2026-Oct-18  Initial   0.0.1   ADCL  Release each AP from its own spin table slot, with a stack of its own
+@@  2026-Oct-18  Initial   0.0.1   ADCL  Each AP takes its mbi from the per-core table, for a kernel of its own
 @@
 @@===================================================================================================================
 
 
+@@
+@@ -- The spin table and the AP stacks (these must match main.c)
+@@    ---------------------------------------------------------
+    .equ    PBL_SPIN,0x5800
+    .equ    PBL_CORE_MBI,0x5810
+    .equ    PBL_STACKS,0x80000
+    .equ    PBL_STACK_SIZE,0x4000
+
+
 @@
 @@ -- Expose some global addresses
 @@    ----------------------------
     .globl      _start
     .globl      DoNothing
+    .globl      EnterKernel
     .globl      GetCBAR
     .globl      Halt
     .globl      entryPoint
+    .globl      receiverGo
+    .globl      warmStub
+    .globl      warmStubEnd
+    .globl      warmBoots
 
 
 @@
@@ -73,25 +92,74 @@ cont:
 wait_loop:
     wfe                                 @@ wait for event
 
+    cmp     r3,#1                       @@ core 1 receives the modules on an early start
+    bne     no_receive
+    ldr     r4,=receiverGo              @@ has kMain() asked for that?
+    ldr     r4,[r4]
+    cmp     r4,#0
+    beq     no_receive
+
+    mov     sp,#0x7000                  @@ core 1 needs a stack of its own, below core 0's
+    bl      ReceiveLate                 @@ receive the modules; this returns when they are all in
+    mov     r3,#1                       @@ the core number did not survive the call
+
+no_receive:
     ldr     r4,=entryPoint              @@ get the address of the kernel
     ldr     r4,[r4]                     @@ and the contents of that variable
-    cmp     r4,#0                       @@ has the kernel been set yet?
+    cmp     r4,#0                       @@ has the loader finished?
     beq     wait_loop                   @@ if not, then we can loop and wait some more
 
+    ldr     r4,=PBL_SPIN                @@ this core's slot in the spin table
+    ldr     r4,[r4,r3,lsl #2]
+    cmp     r4,#0                       @@ has the kernel released this core yet?
+    beq     wait_loop
+
+    mov     r5,#PBL_STACK_SIZE          @@ each core has its own stack: the top of core n's is
+    mla     r6,r3,r5,r5                 @@ PBL_STACKS + (n + 1) * PBL_STACK_SIZE
+    add     sp,r6,#PBL_STACKS
+
     mov     r0,#0xb002                  @@ load the registers with the boot values
     movt    r0,#0x2bad
-    ldr     r1,=mbiLoc                  @@ this is a variable address
-    ldr     r1,[r1]                     @@ and this is its contents
-    mov     r2,#0
+    ldr     r1,=PBL_CORE_MBI            @@ this core's mbi (its own on AMP)
+    ldr     r1,[r1,r3,lsl #2]
+    mov     r2,r3                       @@ and the core number
 
-    mov     pc,r4                       @@ jump to the kenrel code -- the other cpus do not have a valid stack
+    mov     pc,r4                       @@ jump to the kernel code
 
 Halt:
     wfi
     b       Halt
 
+
+@@ -- every core comes back here from the warm stub; the kernel that was running must not be started again
+warmStart:
+    mov     r4,#0
+    ldr     r5,=entryPoint
+    str     r4,[r5]
+    ldr     r5,=receiverGo
+    str     r4,[r5]
+
+    mrc     p15,0,r3,c0,c0,5            @@ Read Multiprocessor Affinity Register
+    and     r3,r3,#0x3                  @@ Extract CPU ID bits
+    cmp     r3,#0
+    bne     _start                      @@ the APs go back to wait_loop
+
+    ldr     r5,=warmBoots               @@ core 0 counts the restart and starts the loader over
+    ldr     r4,[r5]
+    add     r4,r4,#1
+    str     r4,[r5]
+    dsb
+    mov     r2,#0                       @@ there are no ATAGS this time
+    b       _start
+
 @@ -- Clear out bss
 initialize:
+.ifdef PMU_PROFILE
+    mov     r10,r2                      @@ PmuInit() is C -- keep the ATAGS safe
+    bl      PmuInit                     @@ start counting so bssLoop is measured (it touches no bss)
+    mov     r2,r10
+.endif
+
     ldr        r4,=_bssStart
     ldr        r9,=_bssEnd
     mov        r5,#0
@@ -113,6 +181,18 @@ bssLoop:
     b       Halt
 
 
+@@
+@@ -- Jump to the kernel on core 0, with the boot values and the stack of core 0: EnterKernel(entry, mbi, sp)
+@@    -----------------------------------------------------------------------------------------------------
+EnterKernel:
+    mov     sp,r2
+    mov     r4,r0
+    mov     r0,#0xb002
+    movt    r0,#0x2bad
+    mov     r2,#0                       @@ core 0
+    mov     pc,r4
+
+
 @@
 @@ -- Get the hardware location from the CBAR
 @@    ---------------------------------------
@@ -126,6 +206,103 @@ GetCBAR:
 @@    -------------------------------------------
 DoNothing:
     mov     pc,lr                           @@ just return, but the compiler cannot optimize
+    .ltorg                                  @@ the literals so far, so the warm stub only has its own
+
+
+@@
+@@ -- The warm restart stub: kMain() copies this to WARM_STUB (below the loader) for the kernel to jump to on any
+@@    core, in a privileged mode with interrupts off.  It cleans the data cache, turns the caches and the MMU off
+@@    (so the MMU must be off or this page identity mapped), and goes back to the loader if it is still there.  It
+@@    only uses registers, and its literals are copied with it.
+@@    -------------------------------------------------------------------------------------------------------------
+warmStub:
+    cpsid   if                          @@ no interrupts from here on
+    mrs     r11,cpsr
+    and     r11,r11,#0x1f               @@ keep the mode: hyp mode has its own system control register
+    cmp     r11,#0x1a
+    mrceq   p15,4,r10,c1,c0,0           @@ HSCTLR
+    mrcne   p15,0,r10,c1,c0,0           @@ SCTLR
+    tst     r10,#1<<2                   @@ is the data cache on?
+    beq     warmCachesOff
+
+@@ -- clean and invalidate every data cache level by set/way, so the kernel's RAM is intact with the cache off
+    mrc     p15,1,r0,c0,c0,1            @@ CLIDR
+    ands    r3,r0,#0x07000000           @@ the level of coherence
+    mov     r3,r3,lsr #23               @@ times 2
+    beq     warmCleanDone
+    mov     r9,#0                       @@ the cache level (times 2)
+
+warmLevel:
+    add     r2,r9,r9,lsr #1             @@ 3 times the level: its bits in the CLIDR
+    mov     r1,r0,lsr r2
+    and     r1,r1,#7                    @@ the cache type at this level
+    cmp     r1,#2
+    blt     warmNextLevel               @@ no data cache here
+
+    mcr     p15,2,r9,c0,c0,0            @@ CSSELR: select this level
+    isb
+    mrc     p15,1,r1,c0,c0,0            @@ CCSIDR
+    and     r2,r1,#7
+    add     r2,r2,#4                    @@ log2 of the line length
+    movw    r4,#0x3ff
+    ands    r4,r4,r1,lsr #3             @@ the largest way number
+    clz     r5,r4                       @@ the shift for the way number
+    movw    r7,#0x7fff
+    ands    r7,r7,r1,lsr #13            @@ the largest set number
+
+warmSet:
+    mov     r6,r4                       @@ every way of this set
+
+warmWay:
+    orr     r8,r9,r6,lsl r5             @@ the level and the way
+    orr     r8,r8,r7,lsl r2             @@ and the set
+    mcr     p15,0,r8,c7,c14,2           @@ DCCISW: clean and invalidate by set/way
+    subs    r6,r6,#1
+    bge     warmWay
+    subs    r7,r7,#1
+    bge     warmSet
+
+warmNextLevel:
+    add     r9,r9,#2
+    cmp     r3,r9
+    bgt     warmLevel
+
+warmCleanDone:
+    mov     r9,#0
+    mcr     p15,2,r9,c0,c0,0            @@ CSSELR back to level 1
+    dsb
+    isb
+
+@@ -- the MMU, the caches and branch prediction off; the code runs on at the same address
+warmCachesOff:
+    bic     r10,r10,#1<<0               @@ M
+    bic     r10,r10,#1<<2               @@ C
+    bic     r10,r10,#1<<11              @@ Z
+    bic     r10,r10,#1<<12              @@ I
+    cmp     r11,#0x1a
+    mcreq   p15,4,r10,c1,c0,0           @@ HSCTLR
+    mcrne   p15,0,r10,c1,c0,0           @@ SCTLR
+    isb
+    mov     r0,#0
+    mcr     p15,0,r0,c7,c5,0            @@ ICIALLU: invalidate the instruction cache
+    mcr     p15,0,r0,c7,c5,6            @@ BPIALL: and the branch predictor
+    dsb
+    isb
+
+@@ -- the loader is only entered again if the kernel has left it alone
+    ldr     r0,=warmMagic
+    ldr     r0,[r0]
+    ldr     r1,=WARM_MAGIC
+    cmp     r0,r1
+    ldreq   r0,=warmStart
+    bxeq    r0
+
+warmHalt:
+    wfi
+    b       warmHalt
+    .ltorg
+
+warmStubEnd:
 
 
 @@
@@ -133,3 +310,22 @@ DoNothing:
 @@    ---------------------------------------------------
 entryPoint:
     .word   0
+
+
+@@
+@@ -- The warm stub checks for this before it goes back to the loader; the restarts are counted next to it
+@@    ----------------------------------------------------------------------------------------------------
+    .equ    WARM_MAGIC,0x57424c50       @@ "PBLW"
+
+warmMagic:
+    .word   WARM_MAGIC
+
+warmBoots:
+    .word   0
+
+
+@@
+@@ -- On an early start, kMain() sets this to have core 1 receive the modules; ReceiveLate() clears it
+@@    ------------------------------------------------------------------------------------------------
+receiverGo:
+    .word   0
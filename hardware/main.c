@@ -11,6 +11,18 @@
 //  -----------  -------  -------  ----  ---------------------------------------------------------------------------
 //  2018-Dec-25  Initial   0.0.1   ADCL  Initial version
 //  2019-Jun-08  Initial   0.0.1   ADCL  Sent the additional processors to the kernel code as well
+//  2026-Oct-18  Initial   0.0.1   ADCL  Place the MBI by its size and NAK anything that will not fit
+//  2026-Oct-18  Initial   0.0.1   ADCL  Receive the image as framed blocks, checking the CRC of each
+//  2026-Oct-18  Initial   0.0.1   ADCL  Copy duplicate pages locally from the copy-page block
+//  2026-Oct-18  Initial   0.0.1   ADCL  Time each phase and count UART errors; send the telemetry to the server
+//  2026-Oct-18  Initial   0.0.1   ADCL  Optionally profile the receive and store loops with the PMU
+//  2026-Oct-18  Initial   0.0.1   ADCL  Answer clock sync pings before the size and the entry point
+//  2026-Oct-18  Initial   0.0.1   ADCL  Early start: boot the kernel and receive the modules on core 1
+//  2026-Oct-18  Initial   0.0.1   ADCL  Optionally receive the image striped over the mini UART and the PL011
+//  2026-Oct-18  Initial   0.0.1   ADCL  Install the warm restart stub so a kernel can return to the loader
+//  2026-Oct-18  Initial   0.0.1   ADCL  Release the APs through a spin table, each with a stack of its own
+//  2026-Oct-18  Initial   0.0.1   ADCL  AMP: start any AP in a kernel of its own, with its own mbi
+//  2026-Oct-18  Initial   0.0.1   ADCL  Optionally use RTS/CTS flow control on the UARTs
 //
 //===================================================================================================================
 
@@ -30,8 +42,10 @@
 
 #define GPIO_BASE   (HWBASE+0x200000)  
 #define GPIO_FSEL1          (GPIO_BASE+0x04)            // GPIO Function Select 1
+#define GPIO_FSEL3          (GPIO_BASE+0x0c)            // GPIO Function Select 3
 #define GPIO_GPPUD          (GPIO_BASE+0x94)            // GPIO Pin Pull Up/Down Enable
 #define GPIO_GPPUDCLK1      (GPIO_BASE+0x98)            // GPIO Pin Pull Up/Down Enable Clock 0
+#define GPIO_GPPUDCLK2      (GPIO_BASE+0x9c)            // GPIO Pin Pull Up/Down Enable Clock 1 (GPIO 32-53)
 
 
 #define AUX_BASE    (HWBASE+0x215000)                    
@@ -43,8 +57,240 @@
 #define AUX_MU_MCR_REG      (AUX_BASE+0x050)            // Mini UART Modem Control
 #define AUX_MU_LSR_REG      (AUX_BASE+0x054)            // Mini UART Line Status
 #define AUX_MU_CNTL_REG     (AUX_BASE+0x060)            // Mini UART Extra Control
+#define CNTL_RX_AUTOFLOW    (1<<2)                      // drop RTS as the receive FIFO fills
+#define CNTL_TX_AUTOFLOW    (1<<3)                      // hold the transmitter while CTS is not asserted
+#define CNTL_RTS_LOW        (1<<6)                      // RTS is asserted low (as on every USB serial adapter)
+#define CNTL_CTS_LOW        (1<<7)                      // CTS is asserted low
 #define AUX_MU_BAUD_REG     (AUX_BASE+0x068)            // Mini UART Baudrate
 
+#define LSR_DATA_READY      (1<<0)                      // there is at least 1 byte in the receive FIFO
+#define LSR_OVERRUN         (1<<1)                      // a byte was lost; cleared when the LSR is read
+#define LSR_TX_EMPTY        (1<<5)                      // the transmit FIFO can take at least 1 byte
+
+
+#ifdef STRIPE
+#define UART0_BASE  (HWBASE+0x201000)
+#define UART0_DR            (UART0_BASE+0x000)          // PL011 Data Register
+#define UART0_FR            (UART0_BASE+0x018)          // PL011 Flag Register
+#define UART0_IBRD          (UART0_BASE+0x024)          // PL011 Integer Baud Rate Divisor
+#define UART0_FBRD          (UART0_BASE+0x028)          // PL011 Fractional Baud Rate Divisor
+#define UART0_LCRH          (UART0_BASE+0x02c)          // PL011 Line Control
+#define UART0_CR            (UART0_BASE+0x030)          // PL011 Control
+#define UART0_IMSC          (UART0_BASE+0x038)          // PL011 Interrupt Mask Set/Clear
+#define UART0_ICR           (UART0_BASE+0x044)          // PL011 Interrupt Clear
+
+#define FR_RXFE             (1<<4)                      // the receive FIFO is empty
+#define DR_OE               (1<<11)                     // a byte was lost before this one
+
+#define UART0_CLOCK         3000000                     // the firmware default; init_uart_clock in config.txt
+#define UART0_DIVISOR       ((UART0_CLOCK * 4 + 115200 / 2) / 115200)   // in 64ths: IBRD and FBRD together
+
+#define STRIPE_RING         32768                       // how far one UART can get ahead of the other
+#define STRIPE_WIRE_MAX     8192                        // no block has more payload than this (4K, LZ at its worst)
+#define STRIPE_RESYNC_USEC  100000                      // both UARTs quiet this long with a header out of order
+#endif
+
+
+#define ST_BASE     (HWBASE+0x003000)
+#define ST_CLO              (ST_BASE+0x004)             // System Timer Counter Lower 32 bits (1MHz)
+
+
+//
+// -- The block operations for the image, which arrives as a series of framed blocks
+//    ------------------------------------------------------------------------------
+#define BLK_DATA            'D'                         // the payload is the raw bytes
+#define BLK_LZ              'Z'                         // the payload is LZ compressed
+#define BLK_FILL            'F'                         // there is no payload; the block is zeros
+#define BLK_COPY            'C'                         // copy the block from the 4-byte address in the payload
+#define BLK_END             'E'                         // the end of the image
+#define BLK_MARK            'M'                         // module number addr is complete (early start)
+
+
+//
+// -- The header in front of every block of the image (this must match the server)
+//    -----------------------------------------------------------------------------
+typedef struct {
+    uint8_t op;
+    uint8_t rsvd;
+    uint16_t seq;                                       // the block number in this image (only when striped)
+    uint32_t addr;                                      // the physical address of the first byte
+    uint32_t len;                                       // the number of bytes produced in memory
+    uint32_t wireLen;                                   // the number of payload bytes following
+    uint32_t crc;                                       // the CRC-32 of the bytes produced in memory
+} __attribute__((packed)) BlockHdr_t;
+
+
+//
+// -- The commands the server sends before the size and before the entry point (this must match the server)
+//    -----------------------------------------------------------------------------------------------------
+#define CMD_PING            'T'                         // clock sync: answer with the timer at receipt and reply
+#define CMD_SIZE            'S'                         // the image size follows
+#define CMD_SIZE_EARLY      'L'                         // the image size follows; the modules come after the entry
+#define CMD_ENTRY           'E'                         // the entry point follows
+#define CMD_ENTRY_SPIN      'P'                         // the entry point follows; the kernel releases the APs itself
+#define CMD_STRIPE          'D'                         // the image comes over both UARTs (answered with 'D')
+#define CMD_CORE            'C'                         // a CoreKernel_t follows: start that AP in its own kernel
+
+typedef struct {
+    uint32_t core;                                      // 1 to PBL_CORES - 1
+    uint32_t entry;                                     // inside the image
+    uint32_t mbi;                                       // this kernel's own mbi, in the mbi pages
+} __attribute__((packed)) CoreKernel_t;
+
+
+//
+// -- The loader's information for the kernel, at a fixed address so the kernel needs nothing else to find it.  On
+//    an early start, the kernel is running while core 1 is still receiving the modules; each module's flag is set
+//    (after its bytes are in memory) as its last block lands, and `modules` tells when all of them are done.
+//    -------------------------------------------------------------------------------------------------------------
+#define PBL_INFO            0x5000                      // below the stacks: core 0 from 0x8000, core 1 from 0x7000
+#define PBL_INFO_VERSION    4
+#define PBL_MAX_MODULES     256                         // modules past this many have no flag; wait for them all
+
+enum {
+    PBL_MODULES_STREAMING = 1,                          // core 1 is receiving them
+    PBL_MODULES_DONE      = 2,                          // every module is in memory and good
+    PBL_MODULES_FAILED    = 3,                          // the transfer finished, but some module is bad
+};
+
+enum {
+    PBL_MOD_PENDING       = 0,                          // not here yet; do not touch its memory
+    PBL_MOD_READY         = 1,                          // in memory, and every block passed its CRC
+    PBL_MOD_BAD           = 2,                          // in memory, but some block was bad
+};
+
+typedef struct {
+    char magic[4];                                      // "PBLI"
+    uint32_t version;                                   // PBL_INFO_VERSION
+    uint32_t size;                                      // sizeof(PblInfo_t)
+    volatile uint32_t modules;                          // PBL_MODULES_*
+    uint32_t modCount;                                  // the modules in the mbi
+    volatile uint32_t ready[PBL_MAX_MODULES];           // PBL_MOD_* for each module, in mbi order
+    uint32_t warmEntry;                                 // jump here to return to the loader (version 2)
+    uint32_t spinTable;                                 // the release slots, one per core (version 3)
+    uint32_t stackBase;                                 // core n's stack is stackSize bytes from stackBase + n*stackSize
+    uint32_t stackSize;
+    uint32_t coreMbi;                                   // the mbi each core was started with, one per core (version 4)
+    uint32_t ampCores;                                  // bit n: core n is in a kernel of its own (version 4)
+} PblInfo_t;
+
+
+//
+// -- The spin table: each core waits for the loader to finish and then for an address in its own slot, and jumps
+//    there with r0/r1 the multiboot magic and mbi, r2 its core number, and sp at the top of its own stack.  Without
+//    CMD_ENTRY_SPIN, the loader fills every slot with the kernel entry point; with it, the kernel writes the slot
+//    for each core when it is ready for it (then dsb and sev).  A core given a kernel of its own with CMD_CORE is
+//    always released by the loader, into that kernel.  These must match entry.s; the loader must end below
+//    PBL_STACKS (hardware.ld checks).
+//    -------------------------------------------------------------------------------------------------------------
+#define PBL_SPIN            0x5800                      // in the information page, after PblInfo_t
+#define PBL_CORE_MBI        0x5810                      // r1 for each core: the mbi, or its own kernel's on AMP
+#define PBL_CORES           4
+#define PBL_STACKS          0x80000
+#define PBL_STACK_SIZE      0x4000
+#define PBL_STACKS_END      (PBL_STACKS + PBL_CORES * PBL_STACK_SIZE)   // the mbi goes above this
+
+
+//
+// -- The warm restart stub is copied to its own page below PBL_INFO; a kernel that leaves the stub and the loader
+//    alone (WARM_STUB up to the end of the loader's bss) can jump to it to have the loader receive the next kernel
+//    without a power cycle.  See warmStub in entry.s.
+//    ------------------------------------------------------------------------------------------------------------
+#define WARM_STUB           0x4000
+
+
+//
+// -- The phases of the boot that are timestamped from the system timer
+//    -----------------------------------------------------------------
+enum {
+    TEL_START,                                          // kMain() was entered (time since power on)
+    TEL_SERIAL,                                         // the serial port is initialized
+    TEL_GREETING,                                       // the greeting and breaks have been sent
+    TEL_SIZE,                                           // the first command from the server arrived
+    TEL_IMAGE,                                          // the first byte of the image arrived
+    TEL_IMAGE_END,                                      // the last block of the image was received
+    TEL_MBI_END,                                        // the mbi was received
+    TEL_ENTRY,                                          // the entry point was received
+    TEL_COUNT,
+};
+
+
+//
+// -- The telemetry record sent to the server after the entry point is ACKed (this must match the server)
+//    ---------------------------------------------------------------------------------------------------
+#define TEL_VERSION         2
+#define TEL_PMU             (1<<0)                      // a Profile_t follows the telemetry
+#define TEL_WARM            (1<<1)                      // the loader was entered from the warm stub, not the firmware
+
+typedef struct {
+    char magic[4];                                      // "PBLT"
+    uint16_t version;                                   // TEL_VERSION
+    uint16_t size;                                      // sizeof(Telemetry_t)
+    uint32_t stamp[TEL_COUNT];                          // the system timer (in usec) at each phase
+    uint32_t rxBytes;                                   // the bytes received from the server in total
+    uint32_t imageBytes;                                // the bytes received for the image
+    uint32_t overruns;                                  // the times the LSR reported a lost byte
+    uint32_t badBlocks;                                 // the blocks that were out of range or failed the CRC
+    uint32_t maxStall;                                  // the longest wait for a byte in the image (usec)
+    uint32_t maxStallAt;                                // the image bytes received before that wait
+    uint32_t flags;                                     // TEL_PMU
+    uint32_t crc;                                       // the CRC-32 of everything above
+} __attribute__((packed)) Telemetry_t;
+
+
+//
+// -- The regions of the loader the PMU profile accounts to; every cycle belongs to exactly one of them
+//    -------------------------------------------------------------------------------------------------
+enum {
+    PMU_BSS,                                            // the bssLoop in entry.s
+    PMU_OTHER,                                          // init and the handshakes
+    PMU_IDLE,                                           // waiting for the server to start the next phase
+    PMU_SPIN,                                           // SerialGetByte() waiting for the next byte
+    PMU_STORE,                                          // storing, decompressing, filling and copying the image
+    PMU_CRC,                                            // checking the CRC of each block
+    PMU_MBI,                                            // storing the mbi
+    PMU_REGIONS,
+};
+
+#define PMU_EVENTS          4                           // the Cortex-A7 has 4 event counters
+
+
+#ifdef PMU_PROFILE
+//
+// -- The counts for one region (naturally aligned, so the same on both sides without packing)
+//    ----------------------------------------------------------------------------------------
+typedef struct {
+    uint64_t cycles;                                    // PMCCNTR
+    uint32_t events[PMU_EVENTS];                        // the event counters, in pmuEvents order
+    uint32_t bytes;                                     // the bytes the region handled
+    uint32_t rsvd;
+} PmuRegion_t;
+
+
+//
+// -- The profile record sent after the telemetry (this must match the server)
+//    ------------------------------------------------------------------------
+typedef struct {
+    char magic[4];                                      // "PBLP"
+    uint16_t regions;                                   // PMU_REGIONS
+    uint16_t events;                                    // PMU_EVENTS
+    uint8_t eventId[PMU_EVENTS];                        // the event number of each counter
+    uint32_t crc;                                       // the CRC-32 of region[]
+    PmuRegion_t region[PMU_REGIONS];
+} Profile_t;
+
+
+//
+// -- The events counted: the architected ones where there is one
+//    -----------------------------------------------------------
+const uint8_t pmuEvents[PMU_EVENTS] = {
+    0x03,                                               // L1 data cache refill
+    0x01,                                               // L1 instruction cache refill
+    0x10,                                               // branch mispredicted
+    0xc9,                                               // Cortex-A7: a store stalled on a full store buffer
+};
+#endif
+
 
 //
 // -- These are prototypes for things outside this source file
@@ -52,6 +298,13 @@
 extern void DoNothing(void);
 extern uint32_t GetCBAR(void);
 extern void Halt(void);
+extern uint8_t _bssStart[];
+extern uint8_t _bssEnd[];
+extern volatile uint32_t receiverGo;
+extern uint32_t warmStub[];
+extern uint32_t warmStubEnd[];
+extern uint32_t warmBoots;
+extern void EnterKernel(uint32_t entry, uint32_t mbi, uint32_t sp) __attribute__((noreturn));
 
 void SerialPutChar(char c);
 
@@ -60,6 +313,93 @@ void SerialPutChar(char c);
 // -- These are some global variables
 //    -------------------------------
 const uint32_t hwLocn = 0x3f000000;
+uint32_t crcTable[256];
+Telemetry_t telemetry;
+bool stallWatch = false;                                // measure the waits for bytes (only in the image)
+PblInfo_t * const pblInfo = (PblInfo_t *)PBL_INFO;
+volatile uint32_t * const spinTable = (volatile uint32_t *)PBL_SPIN;
+uint32_t * const coreMbi = (uint32_t *)PBL_CORE_MBI;
+CoreKernel_t coreKernel[PBL_CORES];                     // the APs with a kernel of their own (by ampCores)
+uint32_t ampCores;
+uint32_t imageBase, imageSize;                          // the bounds of the image, for core 1 on an early start
+
+
+#ifdef STRIPE
+//
+// -- Each UART's bytes are collected as they arrive, so that neither overruns while the blocks are taken in order
+//    ------------------------------------------------------------------------------------------------------------
+typedef struct {
+    uint8_t buf[STRIPE_RING];
+    uint32_t head;                                      // where the next byte from the UART goes
+    uint32_t tail;                                      // where the next byte is taken from
+} StripeRing_t;
+
+StripeRing_t stripeRing[2];                             // 0 is the mini UART; 1 is the PL011
+bool striped = false;                                   // everything is read through the rings
+int rxPort = 0;                                         // the UART of the block being received
+uint16_t stripeSeq;                                     // the number of the next block
+BlockHdr_t stripeHdr[2];                                // the next header from each UART, once it is complete
+bool stripePending[2];
+#endif
+
+
+#ifdef PMU_PROFILE
+Profile_t profile;
+// -- the region being counted now; kept out of bss (it is 0), since PmuInit() sets it before bss is cleared
+int pmuRegion __attribute__((section(".data"))) = PMU_BSS;
+uint32_t pmuLast[1 + PMU_EVENTS];                       // the counters when it started (0 after PmuInit())
+
+
+//
+// -- Start the PMU counting; this is called from entry.s before the bss is cleared so it cannot touch any
+//    ----------------------------------------------------------------------------------------------------
+void PmuInit(void)
+{
+    pmuRegion = PMU_BSS;                                // -- it is .data, and a warm restart left it anywhere
+
+    for (uint32_t n = 0; n < PMU_EVENTS; n ++) {
+        __asm__ volatile("mcr p15,0,%0,c9,c12,5 \n isb" :: "r"(n));             // PMSELR
+        __asm__ volatile("mcr p15,0,%0,c9,c13,1" :: "r"((uint32_t)pmuEvents[n]));   // PMXEVTYPER
+    }
+
+    __asm__ volatile("mcr p15,0,%0,c9,c12,1" :: "r"(0x80000000 | ((1 << PMU_EVENTS) - 1)));     // PMCNTENSET
+    __asm__ volatile("mcr p15,0,%0,c9,c12,0 \n isb" :: "r"(7));     // PMCR: enable, and reset all counters
+}
+
+
+//
+// -- Charge the counts since the last switch to the current region and start counting for another
+//    --------------------------------------------------------------------------------------------
+int PmuSwitch(int region)
+{
+    PmuRegion_t *r = &profile.region[pmuRegion];
+    uint32_t now;
+
+    __asm__ volatile("mrc p15,0,%0,c9,c13,0" : "=r"(now));                      // PMCCNTR
+    r->cycles += now - pmuLast[0];
+    pmuLast[0] = now;
+
+    for (uint32_t n = 0; n < PMU_EVENTS; n ++) {
+        __asm__ volatile("mcr p15,0,%0,c9,c12,5 \n isb" :: "r"(n));
+        __asm__ volatile("mrc p15,0,%0,c9,c13,2" : "=r"(now));                  // PMXEVCNTR
+        r->events[n] += now - pmuLast[1 + n];
+        pmuLast[1 + n] = now;
+    }
+
+    int prev = pmuRegion;
+    pmuRegion = region;
+    return prev;
+}
+
+
+//
+// -- Count the bytes a region handled
+//    --------------------------------
+static inline void PmuBytes(int region, uint32_t bytes) { profile.region[region].bytes += bytes; }
+#else
+static inline int PmuSwitch(int region) { (void)region; return 0; }
+static inline void PmuBytes(int region, uint32_t bytes) { (void)region; (void)bytes; }
+#endif
 
 
 //
@@ -118,11 +458,101 @@ void SerialInit(void)
     BusyWait(150);
     PUT32(GPIO_GPPUDCLK1, 0x00000000);              // LEARN: Why does this make sense?
 
-    // -- Enable TX/RX
+#ifdef FLOW
+    // -- Select alternate function 5 to put CTS1/RTS1 on GPIO pins 16/17, with no pull either way
+    sel = GET32(GPIO_FSEL1);
+    sel &= ~(7<<18);
+    sel |= (0b010<<18);
+    sel &= ~(7<<21);
+    sel |= (0b010<<21);
+    PUT32(GPIO_FSEL1, sel);
+
+    PUT32(GPIO_GPPUD, 0x00000000);
+    BusyWait(150);
+    PUT32(GPIO_GPPUDCLK1, (1<<16)|(1<<17));
+    BusyWait(150);
+    PUT32(GPIO_GPPUDCLK1, 0x00000000);
+#endif
+
+#ifdef STRIPE
+    // -- Select alternate function 3 to put the PL011 on GPIO pins 32/33, for the other half of a striped image
+    sel = GET32(GPIO_FSEL3);
+    sel &= ~(7<<6);
+    sel |= (0b111<<6);
+    sel &= ~(7<<9);
+    sel |= (0b111<<9);
+    PUT32(GPIO_FSEL3, sel);
+
+    PUT32(GPIO_GPPUD, 0x00000000);
+    BusyWait(150);
+    PUT32(GPIO_GPPUDCLK2, (1<<0)|(1<<1));
+    BusyWait(150);
+    PUT32(GPIO_GPPUDCLK2, 0x00000000);
+
+#ifdef FLOW
+    // -- and its CTS0/RTS0 on GPIO pins 30/31, also alternate function 3
+    sel = GET32(GPIO_FSEL3);
+    sel &= ~(7<<0);
+    sel |= (0b111<<0);
+    sel &= ~(7<<3);
+    sel |= (0b111<<3);
+    PUT32(GPIO_FSEL3, sel);
+
+    PUT32(GPIO_GPPUD, 0x00000000);
+    BusyWait(150);
+    PUT32(GPIO_GPPUDCLK1, (1<<30)|(1<<31));
+    BusyWait(150);
+    PUT32(GPIO_GPPUDCLK1, 0x00000000);
+#endif
+#endif
+
+    // -- Enable TX/RX; with flow control, RTS drops when the receive FIFO has 3 spaces left, and we only send while
+    //    the server asserts CTS
+#ifdef FLOW
+    PUT32(AUX_MU_CNTL_REG, 3 | CNTL_RX_AUTOFLOW | CNTL_TX_AUTOFLOW | CNTL_RTS_LOW | CNTL_CTS_LOW);
+#else
     PUT32(AUX_MU_CNTL_REG, 3);
+#endif
 
     // -- clear the input buffer
     while ((GET32(AUX_MU_LSR_REG) & (1<<0)) != 0) GET32(AUX_MU_IO_REG);
+
+#ifdef STRIPE
+    // -- The PL011 only ever receives: 115200 8N1 with the FIFOs on and no interrupts
+    PUT32(UART0_CR, 0);
+    PUT32(UART0_ICR, 0x7ff);
+    PUT32(UART0_IBRD, UART0_DIVISOR >> 6);
+    PUT32(UART0_FBRD, UART0_DIVISOR & 0x3f);
+    PUT32(UART0_LCRH, (3<<5) | (1<<4));
+    PUT32(UART0_IMSC, 0);
+#ifdef FLOW
+    PUT32(UART0_CR, (1<<14) | (1<<9) | (1<<0));     // -- RTSEn: the PL011 drops RTS as its FIFO fills
+#else
+    PUT32(UART0_CR, (1<<9) | (1<<0));
+#endif
+#endif
+}
+
+
+//
+// -- Read the line status; the overrun bit clears when it is read, so this is the only place to count it.  The
+//    mini UART has no framing error bit -- a framing error turns up as a bad block instead.
+//    --------------------------------------------------------------------------------------------------------
+uint32_t SerialStatus(void)
+{
+    uint32_t lsr = GET32(AUX_MU_LSR_REG);
+    if (lsr & LSR_OVERRUN) telemetry.overruns ++;
+    return lsr;
+}
+
+
+//
+// -- Put a byte to the serial line, with no translation
+//    --------------------------------------------------
+void SerialPutByte(uint8_t b)
+{
+    while ((SerialStatus() & LSR_TX_EMPTY) == 0) { }
+    PUT32(AUX_MU_IO_REG, b);
 }
 
 
@@ -132,8 +562,7 @@ void SerialInit(void)
 void SerialPutChar(char c)
 {
     if (c == '\n') SerialPutChar('\r');
-    while ((GET32(AUX_MU_LSR_REG) & (1<<5)) == 0) { }
-    PUT32(AUX_MU_IO_REG, c);
+    SerialPutByte(c);
 }
 
 
@@ -148,83 +577,684 @@ void SerialPutS(const char *s)
 }
 
 
+//
+// -- Record a wait for a byte, if it is the longest one in the image so far
+//    ----------------------------------------------------------------------
+static void SerialStall(uint32_t start)
+{
+    uint32_t wait = GET32(ST_CLO) - start;
+    if (stallWatch && wait > telemetry.maxStall) {
+        telemetry.maxStall = wait;
+        telemetry.maxStallAt = telemetry.imageBytes;
+    }
+}
+
+
+#ifdef STRIPE
+//
+// -- Move whatever a UART has received into its ring
+//    -----------------------------------------------
+static void StripePump(int port)
+{
+    StripeRing_t *r = &stripeRing[port];
+
+    while (1) {
+        uint32_t b;
+
+        if (port == 0) {
+            if ((SerialStatus() & LSR_DATA_READY) == 0) return;
+            b = GET32(AUX_MU_IO_REG);
+        } else {
+            if (GET32(UART0_FR) & FR_RXFE) return;
+            b = GET32(UART0_DR);
+            if (b & DR_OE) telemetry.overruns ++;
+        }
+
+        telemetry.rxBytes ++;
+        if (r->head - r->tail == STRIPE_RING) telemetry.overruns ++;        // -- the other UART is too far behind
+        else r->buf[r->head ++ % STRIPE_RING] = b;
+    }
+}
+
+
+//
+// -- Get a byte from a UART's ring, keeping both rings filled while it waits
+//    -----------------------------------------------------------------------
+static uint8_t StripeGetByte(int port)
+{
+    StripeRing_t *r = &stripeRing[port];
+
+    StripePump(0);
+    StripePump(1);
+
+    if (r->head == r->tail) {
+        int prev = PmuSwitch(PMU_SPIN);
+        uint32_t start = GET32(ST_CLO);
+        while (r->head == r->tail) {
+            StripePump(0);
+            StripePump(1);
+        }
+
+        SerialStall(start);
+        PmuSwitch(prev);
+    }
+
+    if (stallWatch) telemetry.imageBytes ++;
+    return r->buf[r->tail ++ % STRIPE_RING];
+}
+
+
+//
+// -- Get the header of the next block in order, from whichever UART it comes on; the payload follows on the same one.
+//    A header that cannot be right ends the image (as a bad one), since where its block ends is anyone's guess.
+//    ---------------------------------------------------------------------------------------------------------------
+static void StripeNext(BlockHdr_t *hdr)
+{
+    uint32_t heads = stripeRing[0].head + stripeRing[1].head;
+    uint32_t quiet = GET32(ST_CLO);
+
+    while (1) {
+        for (int port = 0; port < 2; port ++) {
+            StripeRing_t *r = &stripeRing[port];
+
+            StripePump(0);
+            StripePump(1);
+
+            if (!stripePending[port] && r->head - r->tail >= sizeof(BlockHdr_t)) {
+                uint8_t *h = (uint8_t *)&stripeHdr[port];
+                for (uint32_t i = 0; i < sizeof(BlockHdr_t); i ++) h[i] = r->buf[r->tail ++ % STRIPE_RING];
+                if (stallWatch) telemetry.imageBytes += sizeof(BlockHdr_t);
+
+                const uint8_t op = stripeHdr[port].op;
+                if (stripeHdr[port].wireLen > STRIPE_WIRE_MAX || (op != BLK_DATA && op != BLK_LZ && op != BLK_FILL
+                        && op != BLK_COPY && op != BLK_END && op != BLK_MARK)) {
+                    telemetry.badBlocks ++;
+                    hdr->op = BLK_END;
+                    return;
+                }
+
+                stripePending[port] = true;
+            }
+
+            if (stripePending[port] && stripeHdr[port].seq == stripeSeq) {
+                *hdr = stripeHdr[port];
+                stripePending[port] = false;
+                stripeSeq ++;
+                rxPort = port;
+                return;
+            }
+        }
+
+        // -- neither UART has the next block: a header was damaged, so go on with the nearer one
+        if (stripePending[0] && stripePending[1]) {
+            telemetry.badBlocks ++;
+            int16_t d0 = stripeHdr[0].seq - stripeSeq;
+            int16_t d1 = stripeHdr[1].seq - stripeSeq;
+            stripeSeq = stripeHdr[d0 <= d1 ? 0 : 1].seq;
+            continue;
+        }
+
+        // -- only one has a header, and it is not the next one: once both UARTs have gone quiet (the block it was
+        //    waiting for is not coming, as when the last block had its header damaged), go on with it
+        if (stripeRing[0].head + stripeRing[1].head != heads) {
+            heads = stripeRing[0].head + stripeRing[1].head;
+            quiet = GET32(ST_CLO);
+        } else if ((stripePending[0] || stripePending[1]) && GET32(ST_CLO) - quiet > STRIPE_RESYNC_USEC) {
+            telemetry.badBlocks ++;
+            stripeSeq = stripeHdr[stripePending[0] ? 0 : 1].seq;
+            quiet = GET32(ST_CLO);
+        }
+    }
+}
+
+
+//
+// -- Start or end an image: a header taken early from the other UART was not part of it, so put its bytes back
+//    ---------------------------------------------------------------------------------------------------------
+static void StripeReset(void)
+{
+    for (int port = 0; port < 2; port ++) {
+        if (stripePending[port]) stripeRing[port].tail -= sizeof(BlockHdr_t);
+        stripePending[port] = false;
+    }
+
+    stripeSeq = 0;
+    rxPort = 0;
+}
+#endif
+
+
 //
 // -- Get a byte from the serial port -- note: not characters since we read binary values
 //    -----------------------------------------------------------------------------------
 uint8_t SerialGetByte(void)
 {
-    while ((GET32(AUX_MU_LSR_REG) & (1<<0)) == 0) { }
+#ifdef STRIPE
+    if (striped) return StripeGetByte(rxPort);
+#endif
+
+    if ((SerialStatus() & LSR_DATA_READY) == 0) {
+        int prev = PmuSwitch(PMU_SPIN);
+        uint32_t start = GET32(ST_CLO);
+        while ((SerialStatus() & LSR_DATA_READY) == 0) { }
+
+        SerialStall(start);
+        PmuSwitch(prev);
+    }
+
+    telemetry.rxBytes ++;
+    if (stallWatch) telemetry.imageBytes ++;
     return (uint8_t)(GET32(AUX_MU_IO_REG) & 0xff);
 }
 
 
 //
-// -- These are used to sent the APs to the kernel as well
-//    ----------------------------------------------------
-const uint32_t mbiLoc = 0xfe000;
+// -- Wait for a byte to arrive without taking it, and timestamp the phase it starts
+//    ------------------------------------------------------------------------------
+void SerialWait(int phase)
+{
+    int prev = PmuSwitch(PMU_IDLE);
+#ifdef STRIPE
+    while (striped && stripeRing[0].head == stripeRing[0].tail && stripeRing[1].head == stripeRing[1].tail) {
+        StripePump(0);
+        StripePump(1);
+    }
+    if (!striped)
+#endif
+    while ((SerialStatus() & LSR_DATA_READY) == 0) { }
+    telemetry.stamp[phase] = GET32(ST_CLO);
+    PmuSwitch(prev);
+}
+
+
+//
+// -- Get several bytes from the serial port
+//    --------------------------------------
+void SerialGetBytes(uint8_t *buf, uint32_t len)
+{
+    while (len --) *buf++ = SerialGetByte();
+}
+
+
+//
+// -- Build the CRC-32 lookup table (the same polynomial as the server)
+//    -----------------------------------------------------------------
+void Crc32Init(void)
+{
+    for (uint32_t i = 0; i < 256; i ++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k ++) c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+        crcTable[i] = c;
+    }
+}
+
+
+//
+// -- Calculate the CRC-32 of a block of memory
+//    -----------------------------------------
+uint32_t Crc32(const uint8_t *buf, uint32_t len)
+{
+    uint32_t crc = 0xffffffff;
+    while (len --) crc = crcTable[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+
+//
+// -- Get the next byte of an LZ block from the serial port, but never past the end of the block
+//    ------------------------------------------------------------------------------------------
+static inline uint8_t LzByte(uint32_t *left, bool *ok)
+{
+    if (*left == 0) {
+        *ok = false;
+        return 0;
+    }
+
+    (*left) --;
+    return SerialGetByte();
+}
+
+
+//
+// -- Decompress an LZ block straight from the serial port into memory; matches only reach back into this block.
+//    Exactly wireLen bytes are taken from the port however damaged the block is, so the next header is where it
+//    should be; returns false if the block did not decode.
+//    ---------------------------------------------------------------------------------------------------------
+bool LzReceive(uint8_t *dst, uint32_t len, uint32_t wireLen)
+{
+    uint8_t *start = dst;
+    uint8_t *end = dst + len;
+    bool ok = true;
+    uint8_t b;
+
+    while (wireLen && ok) {
+        uint8_t token = LzByte(&wireLen, &ok);
+        uint32_t count = token >> 4;
+
+        if (count == 15) {
+            do { b = LzByte(&wireLen, &ok); count += b; } while (b == 255 && ok);
+        }
+
+        // -- the literals, which must be in the block
+        if (count > wireLen) {
+            ok = false;
+            break;
+        }
+
+        while (count --) {
+            b = LzByte(&wireLen, &ok);
+            if (dst < end) *dst++ = b;
+        }
+
+        // -- the last sequence is only literals
+        if (wireLen == 0) break;
+
+        uint32_t offset = LzByte(&wireLen, &ok);
+        offset |= (LzByte(&wireLen, &ok) << 8);
+
+        count = (token & 0x0f) + 4;
+        if ((token & 0x0f) == 15) {
+            do { b = LzByte(&wireLen, &ok); count += b; } while (b == 255 && ok);
+        }
+
+        // -- the match, which may overlap itself
+        if (!ok || offset == 0 || offset > (uint32_t)(dst - start)) {
+            ok = false;
+            break;
+        }
+
+        while (count -- && dst < end) {
+            *dst = *(dst - offset);
+            dst ++;
+        }
+    }
+
+    // -- whatever is left of a damaged block is drained
+    while (wireLen) {
+        wireLen --;
+        SerialGetByte();
+    }
+
+    return ok;
+}
+
+
+//
+// -- Receive the framed blocks of the image; returns false if any block was bad
+//    --------------------------------------------------------------------------
+bool ReceiveImage(uint32_t base, uint32_t size)
+{
+    BlockHdr_t hdr;
+    const uint32_t bad = telemetry.badBlocks;
+    uint32_t markBad = bad;
+
+#ifdef STRIPE
+    if (striped) StripeReset();
+#endif
+
+    while (1) {
+#ifdef STRIPE
+        if (striped) StripeNext(&hdr);
+        else
+#endif
+        SerialGetBytes((uint8_t *)&hdr, sizeof(BlockHdr_t));
+
+        if (hdr.op == BLK_END) {
+#ifdef STRIPE
+            if (striped) StripeReset();
+#endif
+            return telemetry.badBlocks == bad;
+        }
+
+        // -- all of a module is in memory: make sure the kernel sees its bytes before it sees the flag
+        if (hdr.op == BLK_MARK) {
+            __asm__ volatile("dsb");
+            if (hdr.addr < PBL_MAX_MODULES) {
+                pblInfo->ready[hdr.addr] = (telemetry.badBlocks == markBad ? PBL_MOD_READY : PBL_MOD_BAD);
+            }
+
+            markBad = telemetry.badBlocks;
+            continue;
+        }
+
+        uint8_t *mem = (uint8_t *)hdr.addr;
+        uint32_t len = hdr.len;
+
+        // -- a block outside the image is consumed, but not stored
+        if (hdr.addr < base || len > size || hdr.addr - base > size - len) {
+            telemetry.badBlocks ++;
+            for (uint32_t i = 0; i < hdr.wireLen; i ++) SerialGetByte();
+            continue;
+        }
+
+        switch (hdr.op) {
+        case BLK_DATA:
+            SerialGetBytes(mem, hdr.wireLen < len ? hdr.wireLen : len);
+            for (uint32_t i = len; i < hdr.wireLen; i ++) SerialGetByte();
+            break;
+
+        case BLK_LZ:
+            if (!LzReceive(mem, len, hdr.wireLen)) {
+                telemetry.badBlocks ++;
+                continue;
+            }
+            break;
+
+        case BLK_FILL:
+            while (len --) *mem++ = 0;
+            break;
+
+        case BLK_COPY: {
+            // -- the server has sent this page before; copy it from there (the crc below checks the result)
+            uint32_t src = 0;
+            SerialGetBytes((uint8_t *)&src, hdr.wireLen < sizeof(src) ? hdr.wireLen : sizeof(src));
+            for (uint32_t i = sizeof(src); i < hdr.wireLen; i ++) SerialGetByte();
+
+            if (src < base || src - base > size - len) {
+                telemetry.badBlocks ++;
+                continue;
+            }
+
+            uint8_t *from = (uint8_t *)src;
+            while (len --) *mem++ = *from++;
+            break;
+        }
+
+        default:
+            for (uint32_t i = 0; i < hdr.wireLen; i ++) SerialGetByte();
+            telemetry.badBlocks ++;
+            continue;
+        }
+
+        int prev = PmuSwitch(PMU_CRC);
+        if (Crc32((uint8_t *)hdr.addr, hdr.len) != hdr.crc) telemetry.badBlocks ++;
+        PmuBytes(PMU_CRC, hdr.len);
+        PmuSwitch(prev);
+    }
+}
+
+
+//
+// -- These are used to sent the APs to the kernel as well; the MBI is placed page-aligned just below the kernel
+//    ----------------------------------------------------------------------------------------------------------
+uint32_t mbiLoc = 0xfe000;
 extern uint32_t entryPoint;
 
 
+//
+// -- Refuse the transfer: NAK the server and stop here
+//    -------------------------------------------------
+void Refuse(const char *msg)
+{
+    SerialPutChar('\x15');
+    SerialPutS(msg);
+    Halt();
+}
+
+
+//
+// -- Put a 32-bit value to the serial line, little endian
+//    ----------------------------------------------------
+void SerialPutWord(uint32_t w)
+{
+    for (int i = 0; i < 4; i ++, w >>= 8) SerialPutByte(w & 0xff);
+}
+
+
+//
+// -- Answer the server's commands until it sends `last` or `alt`, returning which; a ping is answered with the
+//    system timer when it arrived and when the answer started, which is how the server lines its clock up with ours
+//    --------------------------------------------------------------------------------------------------------------
+uint8_t Commands(uint8_t last, uint8_t alt)
+{
+    while (1) {
+        uint8_t cmd = SerialGetByte();
+        uint32_t arrived = GET32(ST_CLO);
+
+        if (cmd == last || cmd == alt) return cmd;
+
+        if (cmd == CMD_PING) {
+            uint32_t reply = GET32(ST_CLO);
+            SerialPutByte(CMD_PING);
+            SerialPutWord(arrived);
+            SerialPutWord(reply);
+#ifdef STRIPE
+        } else if (cmd == CMD_STRIPE) {
+            // -- from here, both UARTs are read into the rings; the PL011 starts with nothing in it
+            while ((GET32(UART0_FR) & FR_RXFE) == 0) GET32(UART0_DR);
+            for (int port = 0; port < 2; port ++) stripeRing[port].head = stripeRing[port].tail = 0;
+            striped = true;
+            SerialPutByte(CMD_STRIPE);
+#endif
+        } else if (cmd == CMD_CORE) {
+            // -- the kernel for an AP must be in the image and its mbi with the others, below the kernel
+            CoreKernel_t ck;
+            SerialGetBytes((uint8_t *)&ck, sizeof(ck));
+
+            if (ck.core == 0 || ck.core >= PBL_CORES || ck.entry - imageBase >= imageSize
+                    || ck.mbi < mbiLoc || ck.mbi >= imageBase) {
+                SerialPutChar('\x15');
+            } else {
+                coreKernel[ck.core] = ck;
+                ampCores |= (1 << ck.core);
+                SerialPutChar('\x06');
+            }
+        } else {
+            SerialPutChar('\x15');
+        }
+    }
+}
+
+
+//
+// -- Publish the loader information for the kernel; the modules are either all here already or still to come
+//    -------------------------------------------------------------------------------------------------------
+void PblInfoInit(uint32_t modules)
+{
+    const uint32_t modCount = ((uint32_t *)mbiLoc)[5];          // -- the mbi mods_count
+
+    pblInfo->version = PBL_INFO_VERSION;
+    pblInfo->size = sizeof(PblInfo_t);
+    pblInfo->modules = modules;
+    pblInfo->modCount = modCount;
+    pblInfo->warmEntry = WARM_STUB;
+    pblInfo->spinTable = PBL_SPIN;
+    pblInfo->stackBase = PBL_STACKS;
+    pblInfo->stackSize = PBL_STACK_SIZE;
+    pblInfo->coreMbi = PBL_CORE_MBI;
+    pblInfo->ampCores = ampCores;
+
+    // -- every core is held until entryPoint is set, so the slots are always clear by the time they are looked at
+    for (uint32_t i = 0; i < PBL_CORES; i ++) {
+        spinTable[i] = 0;
+        coreMbi[i] = (ampCores & (1 << i) ? coreKernel[i].mbi : mbiLoc);
+    }
+
+    for (uint32_t i = 0; i < PBL_MAX_MODULES; i ++) {
+        pblInfo->ready[i] = (modules == PBL_MODULES_DONE && i < modCount ? PBL_MOD_READY : PBL_MOD_PENDING);
+    }
+
+    pblInfo->magic[0] = 'P';
+    pblInfo->magic[1] = 'B';
+    pblInfo->magic[2] = 'L';
+    pblInfo->magic[3] = 'I';
+    __asm__ volatile("dsb");
+}
+
+
+//
+// -- Copy the warm restart stub to its page; it is copied again on every boot, in case the last kernel was careless
+//    --------------------------------------------------------------------------------------------------------------
+void WarmInstall(void)
+{
+    uint32_t *to = (uint32_t *)WARM_STUB;
+
+    for (uint32_t *from = warmStub; from < warmStubEnd; ) *to++ = *from++;
+    __asm__ volatile("dsb");
+    __asm__ volatile("mcr p15,0,%0,c7,c5,0 \n isb" :: "r"(0));      // -- ICIALLU: it is code now
+}
+
+
+//
+// -- Core 1 on an early start: receive the modules while the kernel runs on core 0, then return to entry.s to
+//    join the kernel like any other core
+//    --------------------------------------------------------------------------------------------------------
+void ReceiveLate(void)
+{
+    bool ok = ReceiveImage(imageBase, imageSize);
+
+    __asm__ volatile("dsb");
+    pblInfo->modules = (ok ? PBL_MODULES_DONE : PBL_MODULES_FAILED);
+    receiverGo = 0;
+    __asm__ volatile("dsb");
+}
+
+
+//
+// -- Send the telemetry record to the server, which adds it to its report for the session
+//    ------------------------------------------------------------------------------------
+void SendTelemetry(void)
+{
+    const uint8_t *t = (const uint8_t *)&telemetry;
+
+    telemetry.magic[0] = 'P';
+    telemetry.magic[1] = 'B';
+    telemetry.magic[2] = 'L';
+    telemetry.magic[3] = 'T';
+    telemetry.version = TEL_VERSION;
+    telemetry.size = sizeof(Telemetry_t);
+#ifdef PMU_PROFILE
+    telemetry.flags |= TEL_PMU;
+#endif
+    telemetry.crc = Crc32(t, sizeof(Telemetry_t) - sizeof(uint32_t));
+
+    for (uint32_t i = 0; i < sizeof(Telemetry_t); i ++) SerialPutByte(t[i]);
+
+#ifdef PMU_PROFILE
+    // -- the profile follows immediately; the counting stops here
+    PmuSwitch(PMU_OTHER);
+    PmuBytes(PMU_STORE, telemetry.imageBytes);
+    PmuBytes(PMU_SPIN, telemetry.rxBytes);
+
+    const uint8_t *p = (const uint8_t *)&profile;
+    profile.magic[0] = 'P';
+    profile.magic[1] = 'B';
+    profile.magic[2] = 'L';
+    profile.magic[3] = 'P';
+    profile.regions = PMU_REGIONS;
+    profile.events = PMU_EVENTS;
+    for (int n = 0; n < PMU_EVENTS; n ++) profile.eventId[n] = pmuEvents[n];
+    profile.crc = Crc32((const uint8_t *)profile.region, sizeof(profile.region));
+
+    for (uint32_t i = 0; i < sizeof(Profile_t); i ++) SerialPutByte(p[i]);
+#endif
+}
+
+
 //
 // -- This is the main entry point for the hardware component.  It will walk through the steps required to get
 //    the kernel and related modules from the server, and then boot the OS.
 //    --------------------------------------------------------------------------------------------------------
 void kMain(uint32_t atags)
 {
-    typedef void (*kernel_t)(uint32_t r0, uint32_t r1, uint32_t r2) __attribute__((noreturn));
-    kernel_t kernel = (kernel_t)0;
     const uint32_t kernelLoc = 0x100000;
 
+    telemetry.stamp[TEL_START] = GET32(ST_CLO);
+    PmuSwitch(PMU_OTHER);
+    PmuBytes(PMU_BSS, _bssEnd - _bssStart);
     SerialInit();
+    telemetry.stamp[TEL_SERIAL] = GET32(ST_CLO);
+    Crc32Init();
+    WarmInstall();
+    if (warmBoots) telemetry.flags |= TEL_WARM;
 
     // -- this greeting should be sent to the screen on the server side -- then start the conversation.
-    SerialPutS("\n'pi-bootloader' (hardware component) is loaded\n   Waiting for kernel and modules...\n");
+    if (warmBoots) SerialPutS("\n'pi-bootloader' (hardware component) is back from the kernel (warm restart)\n");
+    else SerialPutS("\n'pi-bootloader' (hardware component) is loaded\n");
+    SerialPutS("   Waiting for kernel and modules...\n");
     SerialPutS("\x03\x03\x03");     // send 3 breaks to the server to indicate that we are waiting for a kernel
+    telemetry.stamp[TEL_GREETING] = GET32(ST_CLO);
 
     // -- get the size of the binaries (all-in) -- this is sent in little endian order
     uint32_t binSize = 0;
     char *sz = (char *)&binSize;
 
+    SerialWait(TEL_SIZE);
+    const bool early = (Commands(CMD_SIZE, CMD_SIZE_EARLY) == CMD_SIZE_EARLY);
     sz[0] = SerialGetByte();
     sz[1] = SerialGetByte();
     sz[2] = SerialGetByte();
     sz[3] = SerialGetByte();
-    
-    uint8_t *mem = (uint8_t *)kernelLoc;
 
-    // -- Good so far, get the bytes and store them at 0x100000
-    SerialPutChar('\x06');
-    while (binSize--) *mem++ = SerialGetByte();
+    if (binSize > HWBASE - kernelLoc) Refuse("The kernel and modules will not fit in memory\n");
+
+    // -- Good so far, get the blocks and store them from 0x100000; NAK if any of them were bad.  On an early start
+    //    this is just the kernel, and the modules come once it is running.
+    imageBase = kernelLoc;
+    imageSize = binSize;
     SerialPutChar('\x06');
+    SerialWait(TEL_IMAGE);
+    stallWatch = true;
+    PmuSwitch(PMU_STORE);
+    bool ok = ReceiveImage(kernelLoc, binSize);
+    PmuSwitch(PMU_OTHER);
+    stallWatch = false;
+    telemetry.stamp[TEL_IMAGE_END] = GET32(ST_CLO);
+    SerialPutChar(ok ? '\x06' : '\x15');
 
     // -- Now duplicate the process for the mbi structure
     sz[0] = SerialGetByte();
     sz[1] = SerialGetByte();
     sz[2] = SerialGetByte();
     sz[3] = SerialGetByte();
-    
-    mem = (uint8_t *)mbiLoc;
 
-    // -- Good so far, get the bytes and store them at 0x0fe000
+    if (binSize > kernelLoc - PBL_STACKS_END) Refuse("The MBI will not fit below the kernel\n");
+
+    mbiLoc = (kernelLoc - binSize) & 0xfffff000;
+    uint8_t *mem = (uint8_t *)mbiLoc;
+
+    // -- Good so far, get the bytes and store them just below the kernel
     SerialPutChar('\x06');
+    PmuSwitch(PMU_MBI);
+    PmuBytes(PMU_MBI, binSize);
     while (binSize--) *mem++ = SerialGetByte();
+    PmuSwitch(PMU_OTHER);
+    telemetry.stamp[TEL_MBI_END] = GET32(ST_CLO);
     SerialPutChar('\x06');
 
-    // -- Get the Entry point
+    // -- Get the Entry point, after another round of clock sync
+    const bool spin = (Commands(CMD_ENTRY, CMD_ENTRY_SPIN) == CMD_ENTRY_SPIN);
     uint32_t entry;
     char *e = (char *)&entry;
     e[0] = SerialGetByte();
     e[1] = SerialGetByte();
     e[2] = SerialGetByte();
     e[3] = SerialGetByte();
+    telemetry.stamp[TEL_ENTRY] = GET32(ST_CLO);
     SerialPutChar('\x06');
 
+    // -- on an early start, core 1 is listening for the modules before the server can start sending them
+    PblInfoInit(early ? PBL_MODULES_STREAMING : PBL_MODULES_DONE);
+    if (early) {
+        receiverGo = 1;
+        __asm__ volatile("dsb");
+        __asm__ volatile("sev");
+    }
+
+    SendTelemetry();
+
     // -- If we made it here without an error notify we are booting
     SerialPutS("Booting...\n");
 
+    // -- the APs go with core 0 unless the kernel is going to release them through the spin table; an AP with a
+    //    kernel of its own goes there either way
+    for (uint32_t i = 1; i < PBL_CORES; i ++) {
+        if (ampCores & (1 << i)) spinTable[i] = coreKernel[i].entry;
+        else if (!spin) spinTable[i] = entry;
+    }
+
     entryPoint = entry;
-    kernel = (kernel_t)entry;
     __asm__ volatile("dsb");        // -- perform a memory synchronization since entry needs to be updated
     __asm__ volatile("sev");        // -- send an event tot he other cpus, signaling that it's time to go
-    kernel(0x2badb002, mbiLoc, 0);
+    EnterKernel(entry, mbiLoc, PBL_STACKS + PBL_STACK_SIZE);
 }
\ No newline at end of file
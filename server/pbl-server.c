@@ -36,13 +36,38 @@
 //  this case the program might have been better implemented as a C++ class with all of the attributes private.
 //  However, this is also a standalone program and not a library that will be imported into several other programs.
 //  I made this choice knowing that, at least in this program, the code will never be linked anywhere else.  As a
-//  matter of fact, I have every intention of keeping this to a 1-source-file program.
+//  matter of fact, I have every intention of keeping this to a 1-source-file program.  To that end, `pbl-pack` is
+//  built from this same source with `PBL_PACK` defined, which only changes `main()` and the command line.
 //
 // ------------------------------------------------------------------------------------------------------------------
 //
 //     Date      Tracker  Version  Pgmr  Description
 //  -----------  -------  -------  ----  ---------------------------------------------------------------------------
 //  2018-Dec-26  Initial   0.0.1   ADCL  Initial version
+//  2026-Oct-18  Initial   0.0.1   ADCL  Send the image through a read/transform/write pipeline
+//  2026-Oct-18  Initial   0.0.1   ADCL  Arena-allocated config with no line limit; MBI sized to its content
+//  2026-Oct-18  Initial   0.0.1   ADCL  Frame the image into blocks; add pbl-pack packed boot images
+//  2026-Oct-18  Initial   0.0.1   ADCL  Copy duplicate pages on the rpi rather than sending them again
+//  2026-Oct-18  Initial   0.0.1   ADCL  Lay out the image with per-module alignment instead of 4K padding
+//  2026-Oct-18  Initial   0.0.1   ADCL  Receive the rpi telemetry and report on the session
+//  2026-Oct-18  Initial   0.0.1   ADCL  Report the PMU profile from a profiling build of the hardware
+//  2026-Oct-18  Initial   0.0.1   ADCL  Synchronize with the rpi clock and export a Chrome trace of the boot
+//  2026-Oct-18  Initial   0.0.1   ADCL  Time boot milestones in the console output and keep their history
+//  2026-Oct-18  Initial   0.0.1   ADCL  Add A/B mode: alternate 2 configs and compare them with Welch's t-test
+//  2026-Oct-18  Initial   0.0.1   ADCL  Add channels to the console output; decode the binary kernel log
+//  2026-Oct-18  Initial   0.0.1   ADCL  Collect PC samples from the kernel and profile them with its symbols
+//  2026-Oct-18  Initial   0.0.1   ADCL  Receive file uploads from the kernel; convert trace events to JSON
+//  2026-Oct-18  Initial   0.0.1   ADCL  Serve host files to the booted kernel with a block cache and read-ahead
+//  2026-Oct-18  Initial   0.0.1   ADCL  Add early start: boot the kernel and send the modules while it runs
+//  2026-Oct-18  Initial   0.0.1   ADCL  Stripe the image over a second tty to the rpi PL011
+//  2026-Oct-18  Initial   0.0.1   ADCL  Ask the kernel to return to the loader with Ctrl-] r (warm restart)
+//  2026-Oct-18  Initial   0.0.1   ADCL  Add `smp=spin` to leave the APs in the loader's spin table for the kernel
+//  2026-Oct-18  Initial   0.0.1   ADCL  AMP: a kernel of its own for any core, each with its own modules and mbi
+//  2026-Oct-18  Initial   0.0.1   ADCL  Open the tty as soon as it appears (inotify) and log the hotplug timeline
+//  2026-Oct-18  Initial   0.0.1   ADCL  Put USB serial adapters in low latency mode; report the ping round trip
+//  2026-Oct-18  Initial   0.0.1   ADCL  Reach the rpi through a serial server too: raw TCP or RFC 2217
+//  2026-Oct-18  Initial   0.0.1   ADCL  Add `-r` for RTS/CTS flow control (with a loader built with FLOW)
+//  2026-Oct-18  Initial   0.0.1   ADCL  Record sessions with `-w`; replay them against the server with replay://
 //
 //===================================================================================================================
 
@@ -58,13 +83,224 @@
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <math.h>
+#include <limits.h>
 
 
 //
-// -- A reasonable limit on the number of config lines (kernel + modules) we can support
-//    ----------------------------------------------------------------------------------
-#define MAX_CONFIG_LINES        10
-#define MAX_CFG_FILE_SIZE       (MAX_CONFIG_LINES * 256)
+// -- The size of each chunk the arena allocates for the config, plan, and mbi (larger requests get their own)
+//    -------------------------------------------------------------------------------------------------------
+#define ARENA_CHUNK_SIZE        (1024 * 64)
+
+
+//
+// -- The MBI is placed page-aligned immediately below the kernel at this address
+//    ---------------------------------------------------------------------------
+#define KERNEL_LOC              0x100000
+
+
+//
+// -- The loader's information page (with the spin table and the core stacks), offered to the kernel as the mbi
+//    config table
+//    ---------------------------------------------------------------------------------------------------------
+#define PBL_INFO                0x5000
+#define MAX_CORES               4
+
+
+//
+// -- The rpi memory offered in the mbi memory map, less what the loader keeps for itself: the warm restart stub,
+//    the information page with the spin table, the loader, and the core stacks (these must match main.c)
+//    ------------------------------------------------------------------------------------------------------------
+#define RPI_MEMORY              0x3f000000
+#define LOADER_START            0x4000
+#define LOADER_END              0x90000
+
+
+//
+// -- Modules are aligned to this unless the cfg-file gives them an `align=` attribute
+//    --------------------------------------------------------------------------------
+#define DEFAULT_MOD_ALIGN       4096
+
+
+//
+// -- The send pipeline: buffer size, number of buffers in flight, and ring slots (a power of 2 >= the buffers)
+//    ---------------------------------------------------------------------------------------------------------
+#define PIPE_BUF_SIZE           (1024 * 64)
+#define PIPE_BUF_COUNT          8
+#define RING_SLOTS              16
+
+
+//
+// -- The image goes over the wire in blocks of at most 4K, each framed with a BlockHdr_t
+//    -----------------------------------------------------------------------------------
+#define BLOCK_SIZE              4096
+#define PIPE_FRAME_SLACK        ((PIPE_BUF_SIZE / BLOCK_SIZE + 2) * 32)
+
+
+//
+// -- The block operations
+//    --------------------
+#define BLK_DATA                'D'         // the payload is the raw bytes
+#define BLK_LZ                  'Z'         // the payload is LZ compressed
+#define BLK_FILL                'F'         // there is no payload; the block is zeros
+#define BLK_COPY                'C'         // the payload is the 4-byte address of an identical block already sent
+#define BLK_END                 'E'         // the end of the image; len is the number of blocks sent
+#define BLK_MARK                'M'         // there is no payload; module number addr has been sent in full
+
+
+//
+// -- The LZ compressor hash table size (in bits)
+//    -------------------------------------------
+#define LZ_HASH_BITS            12
+
+
+//
+// -- The packed boot image signature and version
+//    -------------------------------------------
+#define PACK_MAGIC              "PBLPACK"
+#define PACK_VERSION            2
+#define PACK_COMPRESSED         (1<<0)
+#define PACK_SPIN               (1<<1)  // the kernel releases the APs through the spin table
+
+
+//
+// -- The telemetry record signature and version (this must match the hardware)
+//    -------------------------------------------------------------------------
+#define TEL_MAGIC               "PBLT"
+#define TEL_VERSION             2
+#define LINE_RATE               11520   // bytes per second at 115200 8N1
+#define TEL_PMU                 (1<<0)  // a Profile_t follows the telemetry
+#define TEL_WARM                (1<<1)  // the loader came back from a kernel through its warm stub
+#define PROFILE_MAGIC           "PBLP"
+
+
+//
+// -- The commands the rpi answers in the handshake, before the size and before the entry point
+//    -----------------------------------------------------------------------------------------
+#define CMD_PING                'T'     // answered with 'T' and the rpi system timer at receipt and reply
+#define CMD_SIZE                'S'     // the image size follows
+#define CMD_SIZE_EARLY          'L'     // the image size follows; the modules come after the kernel is started
+#define CMD_ENTRY               'E'     // the entry point follows
+#define CMD_ENTRY_SPIN          'P'     // the entry point follows; the kernel releases the APs itself
+#define CMD_CORE                'C'     // a CoreKernel_t follows: start that core in its own kernel (ACK or NAK)
+#define CMD_STRIPE              'D'     // the image comes over both rpi UARTs; answered with 'D' (or a NAK)
+
+
+//
+// -- Clock sync: the pings in each round, and the time one byte takes on the wire at 115200 8N1
+//    ------------------------------------------------------------------------------------------
+#define SYNC_PINGS              8
+#define DEV_BAUD                115200
+#define BYTE_USEC               (10 * 1e6 / DEV_BAUD)
+
+
+//
+// -- The latency timer to ask a USB serial adapter for (ms); an FTDI holds a short packet for 16 ms by default
+//    --------------------------------------------------------------------------------------------------------
+#define LATENCY_TIMER           1
+
+
+//
+// -- The most spans that can be recorded for the trace of one session
+//    ----------------------------------------------------------------
+#define TRACE_MAX               64
+
+
+//
+// -- The most milestone patterns that can be watched for in the console output
+//    -------------------------------------------------------------------------
+#define MAX_MILESTONES          16
+
+
+//
+// -- A/B mode: the runs each side needs before it is compared, and the significance level
+//    ------------------------------------------------------------------------------------
+#define AB_MIN_RUNS             3
+#define AB_ALPHA                0.05
+
+
+//
+// -- The console channels: DLE frames a record in the console output, and 'L' is the binary kernel log
+//    -------------------------------------------------------------------------------------------------
+#define CON_DLE                 0x10
+#define CON_GAP_USEC            1000000 // the longest pause inside a record; longer means the rpi reset
+#define CHAN_LOG                'L'     // the address of a printf format in the kernel, then its 32-bit args
+#define LOG_MAX_ARGS            16
+#define LOG_STRING_MAX          256     // the longest format or %s string read from the kernel
+#define LOG_TEXT_MAX            1024    // the longest expanded log record
+#define LOG_MAX_PHDRS           16
+#define CHAN_PROF               'P'     // PC samples: a frame count and the frames (leaf first), repeated
+#define PROF_MAX_DEPTH          32
+#define PROF_TOP                10      // the functions in the flat profile report
+#define PROF_REPORT_USEC        5000000 // how often the flat profile is reported while samples arrive
+#define CHAN_UPLOAD             'U'     // a file from the kernel, in begin/data/end records
+#define UPLOAD_MAX              8       // the uploads that can be in progress at once
+#define UPLOAD_CHUNK_MAX        65536   // the most a compressed chunk can expand to
+
+
+//
+// -- Warm restart: Ctrl-] then 'r' at the keyboard sends WARM_MAGIC, a channel 'R' record with no payload (framed
+//    like the file service replies), and a kernel that knows it jumps to the warm stub the loader left it, which
+//    sends the triple break again.  Ctrl-] Ctrl-] sends one Ctrl-].
+//    -------------------------------------------------------------------------------------------------------------
+#define CON_ESCAPE              0x1d    // Ctrl-]
+#define CHAN_WARM               'R'
+#define WARM_MAGIC              "\x10R\x00\x00"
+#define WARM_MAGIC_LEN          4
+
+
+//
+// -- The upload records (the first byte of the payload), and the flags on the begin record
+//    -------------------------------------------------------------------------------------
+#define UPLOAD_BEGIN            'B'     // UploadBegin_t, then the file name
+#define UPLOAD_DATA             'D'     // UploadData_t, then the bytes
+#define UPLOAD_LZ               'Z'     // UploadData_t, then the bytes LZ compressed
+#define UPLOAD_END              'E'     // the id only; the file is checked against its length and CRC
+
+#define UPLOAD_EVENTS           0x01    // the file is binary trace events; convert it to Chrome trace JSON
+
+
+//
+// -- The binary trace event file: an EventHdr_t, then Event_t records
+//    ----------------------------------------------------------------
+#define EVENT_MAGIC             "PBLE"
+#define EVENT_VERSION           1
+#define EVENT_BEGIN             'B'     // the same as the Chrome trace phases
+#define EVENT_END               'E'
+#define EVENT_INSTANT           'i'
+#define EVENT_COUNTER           'C'
+
+
+//
+// -- The file service: the kernel sends requests on channel 'F' and the replies come back on the same channel
+//    --------------------------------------------------------------------------------------------------------
+#define CHAN_FILE               'F'
+#define FILE_OPEN               'O'     // FileReq_t, then the path; the status is the handle, then the size follows
+#define FILE_STAT               'S'     // FileReq_t, then the path; a FileStat_t follows the status
+#define FILE_READ               'R'     // FileReadReq_t; the status is the byte count, and the bytes follow
+#define FILE_CLOSE              'C'     // FileReq_t, then the handle
+#define FILE_MAX_OPEN           16
+#define FILE_PATH_MAX           256
+#define FILE_READ_MAX           16384   // the most one read returns
+#define FILE_BLOCK              4096    // the cache block size
+#define FILE_READ_AHEAD         16      // the most blocks loaded ahead of a sequential reader
+#define CACHE_BLOCKS            2048    // 8MB of cache
+#define CACHE_BUCKETS           1024
 
 
 //
@@ -126,6 +362,15 @@ enum {
 };
 
 
+//
+// -- ELF: The program header types we care about
+//    -------------------------------------------
+enum {
+    PT_NULL             = 0,    // Unused entry
+    PT_LOAD             = 1,    // Loadable segment
+};
+
+
 //
 // -- This is the ELF file header, located starting at byte 0
 //    -------------------------------------------------------
@@ -162,6 +407,48 @@ typedef struct {
 } __attribute__((packed)) Elf32_Phdr_t;
 
 
+//
+// -- ELF: The section header types and symbol types we care about
+//    ------------------------------------------------------------
+enum {
+    SHT_SYMTAB          = 2,    // Symbol table
+    STT_OBJECT          = 1,    // Data object
+    STT_FUNC            = 2,    // Function
+};
+
+#define ELF32_ST_TYPE(i)        ((i) & 0xf)
+
+
+//
+// -- This is the ELF Section header -- only used to find the symbol table
+//    --------------------------------------------------------------------
+typedef struct {
+    uint32_t sh_name;
+    uint32_t sh_type;
+    uint32_t sh_flags;
+    uint32_t sh_addr;
+    uint32_t sh_offset;
+    uint32_t sh_size;
+    uint32_t sh_link;
+    uint32_t sh_info;
+    uint32_t sh_addralign;
+    uint32_t sh_entsize;
+} __attribute__((packed)) Elf32_Shdr_t;
+
+
+//
+// -- This is an ELF symbol
+//    ---------------------
+typedef struct {
+    uint32_t st_name;
+    uint32_t st_value;
+    uint32_t st_size;
+    uint8_t st_info;
+    uint8_t st_other;
+    uint16_t st_shndx;
+} __attribute__((packed)) Elf32_Sym_t;
+
+
 //
 // -- This is the type of config line we have
 //    ---------------------------------------
@@ -181,11 +468,509 @@ typedef struct {
     char *fileName;         // this is the file name in the line
     int fd;                 // this is the file descriptor we will read
     int size;               // this is the bytes that will be sent for the file
-    int padding;            // this will be the number of bytes that will be used to pad to 4K
-    char basename[32];      // this is the name that will be offered to the mbi structure
+    uint32_t align;         // this is the alignment of the load address
+    bool spin;              // kernel: the APs wait in the spin table until the kernel releases them
+    int core;               // kernel: the core that runs it (the top kernel is core 0)
+    int kernel;             // module: the line of the kernel it belongs to
+    uint32_t entry;         // kernel: its entry point
+    uint32_t end;           // kernel: the end of its highest segment
+    int elfSects;           // kernel: its program headers
+    Elf32_Phdr_t *phdr;
+    uint32_t mbiAddr;       // kernel: where its own mbi lands on the rpi
+    uint32_t mbiSize;       // kernel: and its size
+    uint32_t addr;          // this is where the file is loaded on the rpi
+    const char *basename;   // this is the name that will be offered to the mbi structure
 } ConfigLine_t;
 
 
+//
+// -- A chunk of memory in the arena; the arena is reset (but the chunks are kept) when the connection resets
+//    -------------------------------------------------------------------------------------------------------
+typedef struct ArenaChunk_t {
+    struct ArenaChunk_t *next;
+    size_t size;            // the number of bytes in data
+    size_t used;            // the number of bytes handed out
+    uint8_t data[];
+} ArenaChunk_t;
+
+
+//
+// -- The image to send is planned as a list of extents, each either read from a file or filled with zeros
+//    ----------------------------------------------------------------------------------------------------
+typedef enum {
+    EXT_FILE,
+    EXT_ZERO,
+    EXT_MEM,                // already framed, memory mapped from a pack file
+    EXT_MARK,               // no bytes: the module numbered offset is complete (early start only)
+} ExtentType_t;
+
+
+//
+// -- One extent of the planned image
+//    -------------------------------
+typedef struct {
+    ExtentType_t type;      // where do the bytes come from?
+    int fd;                 // the file to read when type is EXT_FILE
+    off_t offset;           // the offset in that file (or in the pack file for EXT_MEM)
+    uint32_t addr;          // the physical address on the rpi where these bytes land
+    uint32_t len;           // the number of bytes in this extent
+    const char *name;       // the name to report for progress
+} Extent_t;
+
+
+//
+// -- The bytes waiting for one of the ttys when the image is striped: at most one block
+//    ----------------------------------------------------------------------------------
+typedef struct {
+    uint32_t len;           // the bytes in data
+    uint32_t sent;          // the bytes of those already written
+    uint8_t data[BLOCK_SIZE + 64];
+} StripeOut_t;
+
+
+//
+// -- A reusable pipeline buffer; all of these are allocated statically and recycled through the rings
+//    -------------------------------------------------------------------------------------------------
+typedef struct {
+    uint32_t addr;          // the physical address of the first byte
+    int len;                // the number of valid bytes at ptr
+    uint32_t raw;           // the number of image bytes these bytes represent (set by the transform)
+    bool framed;            // the bytes are already framed for the wire
+    bool mark;              // no bytes: frame a BLK_MARK for the module numbered addr
+    bool last;              // this is the last buffer for this run of the pipeline
+    const uint8_t *ptr;     // the bytes: either data or memory mapped from a pack file
+    uint8_t data[PIPE_BUF_SIZE + PIPE_FRAME_SLACK];
+} PipeBuf_t;
+
+
+//
+// -- A bounded lock-free single-producer/single-consumer ring of buffer pointers
+//    ---------------------------------------------------------------------------
+typedef struct {
+    PipeBuf_t *slot[RING_SLOTS];
+    _Atomic uint32_t head;  // only written by the producer
+    _Atomic uint32_t tail;  // only written by the consumer
+} Ring_t;
+
+
+//
+// -- The header in front of every block of the image on the wire
+//    -----------------------------------------------------------
+typedef struct {
+    uint8_t op;             // one of the BLK_* operations
+    uint8_t rsvd;
+    uint16_t seq;           // the block number in this run of the pipeline (only set when striped)
+    uint32_t addr;          // the physical address of the first byte of the block
+    uint32_t len;           // the number of bytes the block produces in memory
+    uint32_t wireLen;       // the number of payload bytes that follow this header
+    uint32_t crc;           // the CRC-32 of the len bytes produced in memory
+} __attribute__((packed)) BlockHdr_t;
+
+
+//
+// -- An entry in the table of pages already sent, used to find duplicates
+//    --------------------------------------------------------------------
+typedef struct {
+    uint64_t hash;          // the FNV-1a hash of the page
+    uint32_t crc;           // the CRC-32 of the page (so together there are 96 bits to compare)
+    uint32_t addr;          // the address of the page on the rpi; 0 is an empty entry
+} DedupEntry_t;
+
+
+//
+// -- The header of a packed boot image (all offsets are from the start of the file)
+//    ------------------------------------------------------------------------------
+typedef struct {
+    char magic[8];          // PACK_MAGIC
+    uint32_t version;       // PACK_VERSION
+    uint32_t flags;         // PACK_COMPRESSED if the payload was compressed; PACK_SPIN
+    uint32_t entry;         // the kernel entry point
+    uint32_t imageSize;     // the number of bytes reported to the rpi in SEND_SIZE
+    uint32_t imageCrc;      // the CRC-32 of the laid-out image
+    uint32_t mbiOffset;     // the prebuilt mbi
+    uint32_t mbiSize;
+    uint32_t payloadOffset; // the framed blocks, exactly as they go on the wire, ending with BLK_END
+    uint32_t payloadSize;
+    uint32_t indexOffset;   // one PackIndex_t for each block
+    uint32_t blockCount;
+    uint32_t coresOffset;   // one CoreKernel_t for each kernel on a core other than 0
+    uint32_t coreCount;
+} __attribute__((packed)) PackHdr_t;
+
+
+//
+// -- A kernel on a core other than 0 (AMP), as it is sent to the rpi with CMD_CORE and kept in a pack file
+//    -----------------------------------------------------------------------------------------------------
+typedef struct {
+    uint32_t core;          // the core that runs it
+    uint32_t entry;         // its entry point
+    uint32_t mbi;           // the address of its own mbi on the rpi
+} __attribute__((packed)) CoreKernel_t;
+
+
+//
+// -- The index entry for one block of a packed boot image
+//    ----------------------------------------------------
+typedef struct {
+    uint32_t addr;          // the physical address of the block
+    uint32_t len;           // the number of bytes the block produces in memory
+    uint32_t crc;           // the CRC-32 of those bytes
+    uint32_t offset;        // the offset of the BlockHdr_t from the start of the payload
+    uint32_t wireLen;       // the number of bytes on the wire, including the BlockHdr_t
+} __attribute__((packed)) PackIndex_t;
+
+
+//
+// -- The phases of the boot the rpi timestamps from its 1MHz system timer (this must match the hardware)
+//    ---------------------------------------------------------------------------------------------------
+enum {
+    TEL_START,              // the loader was entered (time since power on)
+    TEL_SERIAL,             // the serial port is initialized
+    TEL_GREETING,           // the greeting and breaks have been sent
+    TEL_SIZE,               // the first byte of the image size arrived
+    TEL_IMAGE,              // the first byte of the image arrived
+    TEL_IMAGE_END,          // the last block of the image was received
+    TEL_MBI_END,            // the mbi was received
+    TEL_ENTRY,              // the entry point was received
+    TEL_COUNT,
+};
+
+
+//
+// -- The telemetry record the rpi sends after it ACKs the entry point
+//    ----------------------------------------------------------------
+typedef struct {
+    char magic[4];          // TEL_MAGIC (not terminated)
+    uint16_t version;       // TEL_VERSION
+    uint16_t size;          // sizeof(Telemetry_t)
+    uint32_t stamp[TEL_COUNT];  // the system timer (in usec) at each phase
+    uint32_t rxBytes;       // the bytes the rpi received in total
+    uint32_t imageBytes;    // the bytes the rpi received for the image
+    uint32_t overruns;      // the times the mini UART reported a lost byte
+    uint32_t badBlocks;     // the blocks that were out of range or failed the CRC
+    uint32_t maxStall;      // the longest wait for a byte in the image (usec)
+    uint32_t maxStallAt;    // the image bytes received before that wait
+    uint32_t flags;         // TEL_PMU
+    uint32_t crc;           // the CRC-32 of everything above
+} __attribute__((packed)) Telemetry_t;
+
+
+//
+// -- The regions of the loader a PMU profile accounts to (this must match the hardware)
+//    ----------------------------------------------------------------------------------
+enum {
+    PMU_BSS,                // the bssLoop in entry.s
+    PMU_OTHER,              // init and the handshakes
+    PMU_IDLE,               // waiting for the server to start the next phase
+    PMU_SPIN,               // SerialGetByte() waiting for the next byte
+    PMU_STORE,              // storing, decompressing, filling and copying the image
+    PMU_CRC,                // checking the CRC of each block
+    PMU_MBI,                // storing the mbi
+    PMU_REGIONS,
+};
+
+#define PMU_EVENTS              4
+
+
+//
+// -- The PMU counts for one region of the loader (naturally aligned, so the same on both sides)
+//    ------------------------------------------------------------------------------------------
+typedef struct {
+    uint64_t cycles;        // cpu cycles
+    uint32_t events[PMU_EVENTS];    // the event counters
+    uint32_t bytes;         // the bytes the region handled
+    uint32_t rsvd;
+} PmuRegion_t;
+
+
+//
+// -- The profile a PMU_PROFILE build of the hardware sends after its telemetry
+//    -------------------------------------------------------------------------
+typedef struct {
+    char magic[4];          // PROFILE_MAGIC (not terminated)
+    uint16_t regions;       // PMU_REGIONS
+    uint16_t events;        // PMU_EVENTS
+    uint8_t eventId[PMU_EVENTS];    // the event number of each counter
+    uint32_t crc;           // the CRC-32 of region[]
+    PmuRegion_t region[PMU_REGIONS];
+} Profile_t;
+
+
+//
+// -- The best clock sync sample of a round (all times in usec, relative to the first ping)
+//    -------------------------------------------------------------------------------------
+typedef struct {
+    double host;            // the host time at the middle of the ping
+    double offset;          // the rpi time minus the host time
+    double error;           // the most the offset can be wrong by: half the round trip latency
+    double rtt;             // the round trip of this ping
+} SyncSample_t;
+
+
+//
+// -- The tracks of the trace, and one span on one of them
+//    ----------------------------------------------------
+typedef enum {
+    TRACK_HOST = 1,
+    TRACK_RPI  = 2,
+} Track_t;
+
+typedef struct {
+    const char *name;
+    Track_t track;
+    int64_t start;          // host monotonic usec
+    int64_t end;
+} TraceSpan_t;
+
+
+//
+// -- A milestone: a pattern in the console output, matched as it arrives, and its times across all the runs
+//    ------------------------------------------------------------------------------------------------------
+typedef struct {
+    const char *pattern;    // the text to look for
+    int len;
+    int *fail;              // the KMP failure table for the pattern
+    int pos;                // the number of pattern bytes matched so far
+    int64_t hit;            // when it was seen in this run (usec after the triple break), or -1
+    int64_t *history;       // the times from every run it was seen in
+    int count;
+    int cap;
+} Milestone_t;
+
+
+//
+// -- An A/B metric: the transfer time or a milestone, with the running mean and variance of each side
+//    ------------------------------------------------------------------------------------------------
+typedef struct {
+    int n[2];
+    double mean[2];         // msec
+    double m2[2];           // the sum of the squared differences from the mean (Welford)
+} AbMetric_t;
+
+
+//
+// -- The state of the console framing, carried from one read of the serial port to the next
+//    --------------------------------------------------------------------------------------
+typedef enum {
+    CON_TEXT,                           // plain console text
+    CON_DLE_SEEN,                       // a DLE: either a text DLE or a record follows
+    CON_LEN_LO,                         // the channel has arrived; the length is next
+    CON_LEN_HI,
+    CON_PAYLOAD,
+} ConState_t;
+
+
+//
+// -- A kernel symbol, in the index the PC samples are looked up in
+//    -------------------------------------------------------------
+typedef struct {
+    uint32_t addr;
+    uint32_t size;
+    const char *name;
+} Symbol_t;
+
+
+//
+// -- A folded stack (root first, separated with ';') and the samples that had it
+//    ---------------------------------------------------------------------------
+typedef struct {
+    char *stack;
+    uint32_t hash;
+    uint32_t count;
+} FoldEntry_t;
+
+
+//
+// -- The start of an upload from the kernel; the file name is the rest of the record
+//    -------------------------------------------------------------------------------
+typedef struct {
+    uint8_t op;             // UPLOAD_BEGIN
+    uint8_t id;             // which upload the data and end records are for
+    uint32_t length;        // the length of the file (uncompressed)
+    uint32_t crc;           // the CRC-32 of the whole file
+    uint8_t flags;
+} __attribute__((packed)) UploadBegin_t;
+
+
+//
+// -- A chunk of an upload; the data is the rest of the record
+//    --------------------------------------------------------
+typedef struct {
+    uint8_t op;             // UPLOAD_DATA or UPLOAD_LZ
+    uint8_t id;
+    uint32_t offset;        // where the (uncompressed) chunk goes in the file
+} __attribute__((packed)) UploadData_t;
+
+
+//
+// -- An upload in progress
+//    ---------------------
+typedef struct {
+    int fd;                 // the .part file, or -1
+    char name[128];
+    char part[PATH_MAX];
+    uint32_t length;
+    uint32_t crc;
+    uint8_t flags;
+    uint32_t received;      // the file bytes written so far
+    uint32_t wire;          // and the bytes they took on the wire
+    int64_t start;
+} Upload_t;
+
+
+//
+// -- The binary trace event file header, and an event; the kernel writes them into its trace buffer
+//    ----------------------------------------------------------------------------------------------
+typedef struct {
+    char magic[4];          // EVENT_MAGIC
+    uint16_t version;       // EVENT_VERSION
+    uint16_t reserved;
+    uint32_t tickHz;        // the rate of the event times
+} __attribute__((packed)) EventHdr_t;
+
+typedef struct {
+    uint32_t time;          // in ticks; it may wrap
+    uint32_t name;          // the address of the name string in the kernel
+    uint8_t type;           // EVENT_BEGIN, EVENT_END, EVENT_INSTANT, or EVENT_COUNTER
+    uint8_t cpu;
+    uint16_t tid;
+    uint32_t arg;           // the value of a counter, or an argument to show
+} __attribute__((packed)) Event_t;
+
+
+//
+// -- A file service request and its reply; the tag is the kernel's, so it can have several requests outstanding
+//    ----------------------------------------------------------------------------------------------------------
+typedef struct {
+    uint8_t op;
+    uint8_t tag;
+} __attribute__((packed)) FileReq_t;
+
+typedef struct {
+    uint8_t op;             // FILE_READ
+    uint8_t tag;
+    uint8_t handle;
+    uint32_t offset;
+    uint16_t length;
+} __attribute__((packed)) FileReadReq_t;
+
+typedef struct {
+    uint8_t op;             // the same as the request
+    uint8_t tag;
+    int32_t status;         // a negative errno on an error
+} __attribute__((packed)) FileReply_t;
+
+typedef struct {
+    uint32_t size;
+    uint32_t mtime;
+    uint32_t mode;          // the host st_mode
+} __attribute__((packed)) FileStat_t;
+
+
+//
+// -- A file the kernel has open, and a block in the file cache
+//    ---------------------------------------------------------
+typedef struct {
+    int fd;                 // or -1 when the handle is free
+    dev_t dev;
+    ino_t ino;
+    int64_t mtime;          // nsec; a file that changes gets new cache blocks
+    uint32_t size;
+    uint32_t next;          // the offset a sequential reader will ask for next
+    uint32_t ahead;         // the blocks to read ahead, doubling while the reads stay sequential
+} OpenFile_t;
+
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    int64_t mtime;
+    uint32_t block;
+    uint32_t len;           // short only for the last block of the file
+    uint64_t used;          // the LRU clock when it was last used; 0 when it is free
+    int bucket;             // the hash chain it is on, or -1
+    int next;
+    uint8_t data[FILE_BLOCK];
+} CacheBlock_t;
+
+
+//
+// -- How the rpi serial line is reached: a local tty, or a serial server on the network (`tcp://host:port` for a
+//    raw socket, `rfc2217://host:port` for telnet with the com port option, which also sets the line up), or a
+//    recorded session played back as the rpi (`replay://file`)
+//    ----------------------------------------------------------------------------------------------------------
+typedef enum {
+    XPORT_TTY,
+    XPORT_TCP,
+    XPORT_RFC2217,
+    XPORT_REPLAY,
+} Transport_t;
+
+
+//
+// -- A session file (-w) records both directions of the byte stream with the rpi and the state changes in main().
+//    Each record is its type, the usec since the record before it as a varint, and then either the length of its
+//    bytes as a varint and the bytes, or (SESS_STATE) the new state as a varint.
+//    -------------------------------------------------------------------------------------------------------------
+#define SESSION_MAGIC           "PBLW"
+#define SESSION_VERSION         1
+
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t hdrSize;
+    uint32_t baud;
+    uint32_t reserved;
+    int64_t started;                    // the wall clock at the start, in usec since the epoch
+} SessionHdr_t;
+
+typedef enum {
+    SESS_OPEN       = 'o',              // the device was opened (no bytes)
+    SESS_RX         = 'r',              // bytes from the rpi
+    SESS_TX         = 'w',              // bytes to the rpi
+    SESS_STATE      = 's',              // main() went to a new state
+} SessionRec_t;
+
+
+//
+// -- In a replay, the server has this long past the recorded gap to send what it sent in the session, before the
+//    replay gives up on it
+//    -----------------------------------------------------------------------------------------------------------
+#define REPLAY_STALL_USEC       5000000
+
+
+//
+// -- Telnet (RFC 854) and its com port option (RFC 2217); only what it takes to set the line and pass bytes
+//    ------------------------------------------------------------------------------------------------------
+#define TEL_SE                  240
+#define TEL_SB                  250
+#define TEL_WILL                251
+#define TEL_WONT                252
+#define TEL_DO                  253
+#define TEL_DONT                254
+#define TEL_IAC                 255
+
+#define TELOPT_BINARY           0
+#define TELOPT_SGA              3
+#define TELOPT_COM_PORT         44
+
+#define CPO_SET_BAUDRATE        1
+#define CPO_SET_DATASIZE        2
+#define CPO_SET_PARITY          3
+#define CPO_SET_STOPSIZE        4
+#define CPO_SET_CONTROL         5
+#define CPO_FLOW_NONE           1       // the values of CPO_SET_CONTROL for outbound flow control
+#define CPO_FLOW_HARDWARE       3
+#define CPO_SERVER              100     // the server answers each with the same code + 100
+
+typedef enum {
+    TELNET_DATA,
+    TELNET_IAC,                         // an IAC: a command or a data 0xff follows
+    TELNET_OPT,                         // WILL/WONT/DO/DONT: the option is next
+    TELNET_SB,                          // in a subnegotiation, until IAC SE
+    TELNET_SB_IAC,
+} TelnetState_t;
+
+
 //
 // -- This enum indicates the state of the server
 //    -------------------------------------------
@@ -202,112 +987,111 @@ typedef enum {
     SEND_MBI_SIZE   = 0x1008,           // send the size of the MBI structure
     SEND_MBI        = 0x1009,           // send the mbi itself
     SEND_ENTRY      = 0x100a,           // send the entry point to the rpi
+    RECV_TELEMETRY  = 0x100b,           // receive the telemetry from the rpi and report on the session
+    SEND_LATE       = 0x100c,           // send the modules while the kernel runs (early start)
 } State_t;
 
 
 //
-// -- This is the Multiboot 1 information structure as defined by the spec and padded to 8K to be contiguous
+// -- This is the Multiboot 1 information structure as defined by the spec; the tables and strings follow it
 //    ------------------------------------------------------------------------------------------------------
-typedef union {
-    struct MB1 {
-        //
-        // -- These flags indicate which data elements have valid data
-        //    --------------------------------------------------------
-        uint32_t flags;
-
-        //
-        // -- The basic memory limits are valid when flag 0 is set; these values are in kilobytes
-        //    -----------------------------------------------------------------------------------
-        uint32_t availLowerMem;
-        uint32_t availUpperMem;
-
-        //
-        // -- The boot device when flag 1 is set
-        //    ----------------------------------
-        uint32_t bootDev;
-
-        //
-        // -- The command line for this kernel when flag 2 is set
-        //    ---------------------------------------------------
-        uint32_t cmdLine;
-
-        //
-        // -- The loaded module list when flag 3 is set
-        //    -----------------------------------------
-        uint32_t modCount;
-        uint32_t modAddr;
-
-        //
-        // -- The ELF symbol information (a.out-type symbols are not supported) when flag 5 is set
-        //    ------------------------------------------------------------------------------------
-        uint32_t shdrNum;                 // may still be 0 if not available
-        uint32_t shdrSize;
-        uint32_t shdrAddr;
-        uint32_t shdrShndx;
-
-        //
-        // -- The Memory Map information when flag 6 is set
-        //    ---------------------------------------------
-        uint32_t mmapLen;
-        uint32_t mmapAddr;
-
-        //
-        // -- The Drives information when flag 7 is set
-        //    -----------------------------------------
-        uint32_t drivesLen;
-        uint32_t drivesAddr;
-
-        //
-        // -- The Config table when flag 8 is set
-        //    -----------------------------------
-        uint32_t configTable;
-
-        //
-        // -- The boot loader name when flag 9 is set
-        //    ---------------------------------------
-        uint32_t bootLoaderName;
-
-        //
-        // -- The APM table location when bit 10 is set
-        //    -----------------------------------------
-        uint32_t apmTable;
-
-        //
-        // -- The VBE interface information when bit 11 is set
-        //    ------------------------------------------------
-        uint32_t vbeControlInfo;
-        uint32_t vbeModeInfo;
-        uint16_t vbeMode;
-        uint16_t vbeInterfaceSeg;
-        uint16_t vbeInterfaceOff;
-        uint16_t vbeInterfaceLen;
-
-        //
-        // -- The FrameBuffer information when bit 12 is set
-        //    ----------------------------------------------
-        uint64_t framebufferAddr;
-        uint32_t framebufferPitch;
-        uint32_t framebufferWidth;
-        uint32_t framebufferHeight;
-        uint8_t framebufferBpp;
-        uint8_t framebufferType;
-        union {
-            struct {
-                uint8_t framebufferRedFieldPos;
-                uint8_t framebufferRedMaskSize;
-                uint8_t framebufferGreenFieldPos;
-                uint8_t framebufferGreenMaskSize;
-                uint8_t framebufferBlueFieldPos;
-                uint8_t framebufferBlueMaskSize;
-            };
-            struct {
-                uint32_t framebufferPalletAddr;
-                uint16_t framebufferPalletNumColors;
-            };
+typedef struct MB1 {
+    //
+    // -- These flags indicate which data elements have valid data
+    //    --------------------------------------------------------
+    uint32_t flags;
+
+    //
+    // -- The basic memory limits are valid when flag 0 is set; these values are in kilobytes
+    //    -----------------------------------------------------------------------------------
+    uint32_t availLowerMem;
+    uint32_t availUpperMem;
+
+    //
+    // -- The boot device when flag 1 is set
+    //    ----------------------------------
+    uint32_t bootDev;
+
+    //
+    // -- The command line for this kernel when flag 2 is set
+    //    ---------------------------------------------------
+    uint32_t cmdLine;
+
+    //
+    // -- The loaded module list when flag 3 is set
+    //    -----------------------------------------
+    uint32_t modCount;
+    uint32_t modAddr;
+
+    //
+    // -- The ELF symbol information (a.out-type symbols are not supported) when flag 5 is set
+    //    ------------------------------------------------------------------------------------
+    uint32_t shdrNum;                 // may still be 0 if not available
+    uint32_t shdrSize;
+    uint32_t shdrAddr;
+    uint32_t shdrShndx;
+
+    //
+    // -- The Memory Map information when flag 6 is set
+    //    ---------------------------------------------
+    uint32_t mmapLen;
+    uint32_t mmapAddr;
+
+    //
+    // -- The Drives information when flag 7 is set
+    //    -----------------------------------------
+    uint32_t drivesLen;
+    uint32_t drivesAddr;
+
+    //
+    // -- The Config table when flag 8 is set
+    //    -----------------------------------
+    uint32_t configTable;
+
+    //
+    // -- The boot loader name when flag 9 is set
+    //    ---------------------------------------
+    uint32_t bootLoaderName;
+
+    //
+    // -- The APM table location when bit 10 is set
+    //    -----------------------------------------
+    uint32_t apmTable;
+
+    //
+    // -- The VBE interface information when bit 11 is set
+    //    ------------------------------------------------
+    uint32_t vbeControlInfo;
+    uint32_t vbeModeInfo;
+    uint16_t vbeMode;
+    uint16_t vbeInterfaceSeg;
+    uint16_t vbeInterfaceOff;
+    uint16_t vbeInterfaceLen;
+
+    //
+    // -- The FrameBuffer information when bit 12 is set
+    //    ----------------------------------------------
+    uint64_t framebufferAddr;
+    uint32_t framebufferPitch;
+    uint32_t framebufferWidth;
+    uint32_t framebufferHeight;
+    uint8_t framebufferBpp;
+    uint8_t framebufferType;
+    union {
+        struct {
+            uint8_t framebufferRedFieldPos;
+            uint8_t framebufferRedMaskSize;
+            uint8_t framebufferGreenFieldPos;
+            uint8_t framebufferGreenMaskSize;
+            uint8_t framebufferBlueFieldPos;
+            uint8_t framebufferBlueMaskSize;
         };
-    } MB1;
-    uint8_t raw[8192];
-} __attribute__((packed)) MB1_t;
+        struct {
+            uint32_t framebufferPalletAddr;
+            uint16_t framebufferPalletNumColors;
+        };
+    };
+} MB1_t;
 
 
 //
@@ -321,6 +1105,15 @@ typedef struct Mb1MmapEntry_t {
 } __attribute__((packed)) Mb1MmapEntry_t;
 
 
+//
+// -- A range of rpi memory, for building the memory map
+//    --------------------------------------------------
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+} Range_t;
+
+
 //
 // -- This is the loaded modules block (which will repeat)
 //    ----------------------------------------------------
@@ -337,6 +1130,12 @@ typedef struct Mb1Mods_t {
 //    ----------------------------------------------------------------------------------
 const char *dev;
 const char *cfg;
+const char *packName;                   // pbl-pack only: the packed image to write
+bool compress = false;                  // LZ compress the image blocks
+bool earlyStart = false;                // -e: start the kernel before the modules are sent
+bool smpSpin = false;                   // the kernel line has `smp=spin` (or the pack file was made from one)
+const char *stripeDev = NULL;           // -s: the tty wired to the rpi PL011, to stripe the image over both
+bool rtsCts = false;                    // -r: RTS/CTS flow control on the ttys (the loader must be built with FLOW)
 struct termios oldTio, newTio;
 
 //
@@ -345,87 +1144,3443 @@ int fdDev = -1;
 int fdMax = 0;
 State_t state = OPEN_DEV;         // start needing to reset the state
 fd_set readSet, writeSet, exceptSet;
-ConfigLine_t cfgLines[MAX_CONFIG_LINES];
-char cfgFile[MAX_CFG_FILE_SIZE] = {0};
+ArenaChunk_t *arena = NULL;             // the config, plan, and mbi are all allocated from here
+ConfigLine_t *cfgLines = NULL;          // one for each line in the config file
+int cfgCount = 0;
+char *cfgFile = NULL;
 uint32_t entry = 0;                     // keep track of the kernel entry point
-uint8_t elfHdr[4096] = {0};                      // this is a modest buffer size for 1 elf page
-int elfSects = 0;
-Elf32_Phdr_t *phdr = 0;
-MB1_t mbi;
-uint32_t mbiSize = sizeof(struct MB1);
+int cfgKernels = 0;                     // the kernel lines in the config; more than 1 is AMP
+CoreKernel_t coreKernels[MAX_CORES];    // the kernels on the other cores
+int coreKernelCount = 0;
+uint8_t *mbi = NULL;                    // the mbi image, sized to its content once the image is planned
+uint32_t mbiSize = 0;
+uint32_t mbiLoc = 0;                    // where the mbi will land on the rpi
 uint32_t modLocation = 0;
 
+//
+// -- These global variables are the send pipeline and the image plan it executes
+Extent_t *plan = NULL;
+int planCap = 0;
+int planCount = 0;
+int planKernelCount = 0;                // the kernel extents are first in the plan
+bool planFramed = false;                // the plan is already framed (from a pack file)
+bool lateModules = false;               // this boot sends the modules after the kernel is started
+uint32_t imageSize = 0;                 // the span of the image from KERNEL_LOC
+PipeBuf_t readBufs[PIPE_BUF_COUNT];     // raw image buffers: reader -> transform
+PipeBuf_t xformBufs[PIPE_BUF_COUNT];    // framed buffers: transform -> writer
+Ring_t readFree, readRing;              // transform->reader, reader->transform
+Ring_t xformFree, xformRing;            // writer->transform, transform->writer
+sem_t readerGo, xformGo, writerGo, pipeDone;
+int pipeFd = -1;                        // where the writer sends the framed image
+int pipeFirst = 0, pipeLast = 0;        // the extents of the plan this run of the pipeline sends
+int fdStripe = -1;                      // the second tty, when striping
+int fdWatch = -1;                       // inotify on the directories of the tty, while it is missing
+Transport_t devTransport = XPORT_TTY;   // from the form of <dev>
+TelnetState_t telnetState = TELNET_DATA;
+uint8_t telnetCmd = 0;                  // the WILL/WONT/DO/DONT waiting for its option
+uint8_t telnetSb[16];                   // the subnegotiation so far (anything longer is not looked at)
+int telnetSbLen = 0;
+const char *sessionName = NULL;         // -w: record the session here
+FILE *sessionFile = NULL;
+pthread_mutex_t sessionLock = PTHREAD_MUTEX_INITIALIZER;    // the pipeline writer records from its own thread
+int64_t sessionLast = 0;                // the time of the last record
+bool replayFast = false;                // -F: replay the session as fast as the server takes it
+uint8_t *replayMap = NULL;              // the session file being replayed
+size_t replaySize = 0;
+int replayFd = -1;                      // the rpi end of the socket pair; fdDev is the other end
+pthread_t replayThread;
+bool replayStarted = false;
+uint32_t *replayStates = NULL;          // the recorded state changes, in order
+int replayStateCount = 0;
+int replayStateAt = 0;                  // the state changes of the replay so far
+int replayStateDiff = -1;               // the first one that did not match the recording
+uint32_t replayStateWas = 0;            // and the state it went to instead
+int64_t replayRecorded = 0;             // the length of the recorded session
+int64_t replayStart = 0;
+struct {                                // these belong to the replay thread until it is joined
+    uint64_t rx;                        // bytes played to the server as the rpi
+    uint64_t tx;                        // bytes the server sent
+    uint64_t differ;
+    int64_t firstDiffer;
+    bool stalled;
+    int64_t end;
+} replayStats;
+int64_t hotplugWait = 0;                // when the tty was found missing (0 when it was there all along)
+int64_t hotplugEvent = 0;               // the directory change that the open followed
+int64_t hotplugOpen = 0;                // when it was opened, until the first byte arrives
+bool stripeActive = false;              // the rpi agreed to take this image over both ttys
+uint16_t stripeSeq = 0;                 // the next block number (writer stage only, like the rest of these)
+int stripePort = 0;                     // the tty the current block is going to
+StripeOut_t stripeOut[2];               // the blocks each tty has been given but not yet taken
+uint32_t stripeLeft = 0;                // the payload bytes of the current block still to write
+uint8_t stripeHdr[sizeof(BlockHdr_t)];  // the header of the next block, as it is collected
+int stripeHdrLen = 0;
+uint64_t stripeBytes[2];                // the bytes written to each tty in this run
+int64_t stripeStart = 0;
+_Atomic bool pipeError = false;
+_Atomic uint32_t pipeBytesSent = 0;     // bytes on the wire
+_Atomic uint32_t pipeRawSent = 0;       // image bytes those represent
+uint32_t crcTable[256];
+uint32_t imageCrc = 0;                  // only touched by the transform stage while it runs
+uint32_t blocksSent = 0;                // ditto
+PackIndex_t *packIndex = NULL;          // when set, the transform records each block here
+DedupEntry_t *dedupTable = NULL;        // the pages already sent (allocated when the image is planned)
+uint32_t dedupMask = 0;
+uint32_t dedupPages = 0;                // the number of pages copied on the rpi (transform stage only)
+bool pipeDedup = false;                 // this run may copy pages it has already sent
+bool pipeFinished = true;
+int64_t imageStart, imageEnd;           // when the host started sending the image and when it was ACKed (usec)
 
 //
-// --  Handle the Ctrl-C to clean up properly
+// -- These global variables are the clock sync with the rpi and the trace of the session
+SyncSample_t syncBest[2];               // the best sample of the rounds before the size and before the entry
+int syncRounds = 0;
+int64_t syncBaseHost = 0;               // the host and rpi times of the first ping; everything is relative
+uint32_t syncBasePi = 0;
+double syncDrift = 0;                   // the rpi clock runs this much fast (as a fraction)
+bool linkMeasured = false;              // the round trip has been reported since the tty was opened
+const char *traceName = NULL;           // -t: write the Chrome trace here
+TraceSpan_t trace[TRACE_MAX];
+int traceCount = 0;
+int64_t sessionStart = 0;               // when the triple break was seen
+int64_t phaseStart = 0;                 // when the current phase of the transfer started
+
+//
+// -- These global variables are the boot milestones and their history across runs
+Milestone_t milestones[MAX_MILESTONES];
+int milestoneCount = 0;
+bool milestonesArmed = false;           // a run is in progress: the triple break has been seen
+int milestoneRuns = 0;                  // the runs that saw at least one milestone
+const char *historyName = NULL;         // -M: the milestone history is kept in this file
+
+//
+// -- These global variables are A/B mode, when 2 configs are given
+const char *abCfg[2] = { NULL, NULL };
+int abSide = 0;                         // the side of the boot in progress (0 is A)
+int abBoots = 0;
+AbMetric_t abMetrics[1 + MAX_MILESTONES];   // the transfer time, then each milestone
+int64_t transferStart = 0;              // when the size was sent
+
+//
+// -- These global variables are the console channels and the binary log; the kernel is kept open across boots so
+//    its strings are still there once the rpi has booted it
+const char *logElfName = NULL;          // -k: the kernel to read the log strings from (default: the one last sent)
+int logElfFd = -1;
+Elf32_Phdr_t logPhdr[LOG_MAX_PHDRS];
+int logPhdrCount = 0;
+ConState_t conState = CON_TEXT;
+int conBreaks = 0;                      // consecutive breaks seen in the text
+uint8_t conChan = 0;
+uint32_t conLen = 0;
+uint32_t conGot = 0;
+int64_t conLast = 0;                    // when the last console bytes were read
+char conText[1024];                     // text is collected here so that records are not written mid-line
+size_t conTextLen = 0;
+uint8_t conPayload[65536];
+int logRecords = 0;
+int logWire = 0;                        // the bytes the log records took on the wire
+int logText = 0;                        // the bytes of text they expanded to
+
+//
+// -- These global variables are the PC sample profile; the symbols come from the same kernel as the log strings
+Symbol_t *symbols = NULL;               // sorted by address
+int symCount = 0;
+char *symNames = NULL;
+uint32_t *profCounts = NULL;            // the self samples for each symbol, and one more for the unknowns
+uint32_t profSamples = 0;
+int64_t profReported = 0;
+FoldEntry_t *foldTable = NULL;          // open addressing; the capacity is a power of 2
+int foldCap = 0;
+int foldCount = 0;
+const char *foldedName = NULL;          // -p: write the folded stacks here at the end of each boot
+
+//
+// -- These global variables are the file uploads from the kernel
+const char *uploadRoot = NULL;          // -u: each session gets a directory in here
+char uploadDir[PATH_MAX - 256] = { 0 }; // this session's directory, once something is uploaded
+Upload_t uploads[UPLOAD_MAX];
+bool uploadWarned = false;
+
+//
+// -- These global variables are the file service and the bytes queued for the rpi while in tty mode
+const char *fileRoot = NULL;            // -f: the directory the kernel can read files from
+bool fileWarned = false;
+OpenFile_t openFiles[FILE_MAX_OPEN];
+CacheBlock_t *cache = NULL;             // the cache lasts across boots; it is keyed by the file and its mtime
+int cacheBucket[CACHE_BUCKETS];
+uint64_t cacheClock = 0;
+struct {
+    uint32_t requests;
+    uint32_t readBytes;
+    uint32_t replyBytes;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t readAhead;
+} fileStats;
+uint8_t *conTx = NULL;
+size_t conTxLen = 0;
+size_t conTxSent = 0;
+size_t conTxCap = 0;
+bool conEscape = false;                 // Ctrl-] was typed; the next key says what for
+int64_t warmAsked = 0;                  // when the kernel was last asked to return to the loader
+
+//
+// -- These global variables are the memory mapped pack file when one is given in place of a cfg-file
+uint8_t *packMap = NULL;
+size_t packMapSize = 0;
+PackHdr_t *packHdr = NULL;
+
+
+//
+// --  Handle the Ctrl-C to clean up properly
 //     --------------------------------------
 void SignalHandler(int sig)
 {
-    printf("Caught signal %d; exiting            \n", sig);
-    exit(EXIT_SUCCESS);
+    printf("Caught signal %d; exiting            \n", sig);
+    exit(EXIT_SUCCESS);
+}
+
+
+//
+// -- On normal exit, use this function to clean up
+//    ---------------------------------------------
+void Cleanup(void)
+{
+    if (fdDev != -1) close(fdDev);
+    fdDev = -1;
+
+    // -- restore settings for STDIN_FILENO
+    if (isatty(STDIN_FILENO)) tcsetattr(STDIN_FILENO, TCSANOW, &oldTio);
+}
+
+
+//
+// -- Print the usage information and then exit
+//    -----------------------------------------
+void PrintUsage(const char * const pgm)
+{
+    printf("\nUsage:\n");
+#ifdef PBL_PACK
+    printf("  %s [-z] <cfg-file> <pack-file>\n", pgm);
+#else
+    printf("  %s [-z] [-e] [-r] [-s <dev2>] [-t <trace-file>] [-m <pattern>]... [-M <history-file>] [-k <kernel-elf>]\n"
+            "      [-p <folded-file>] [-u <upload-dir>] [-f <file-dir>] [-w <session-file>] [-F]\n"
+            "      <dev> <cfg-file|pack-file> [<cfg-B>]\n", pgm);
+    printf("  <dev> is a tty, or a serial server: tcp://<host>:<port> (raw) or rfc2217://<host>:<port>,\n"
+            "      or a recorded session to play back as the rpi: replay://<session-file>\n");
+#endif
+    printf("    -z  LZ compress the image blocks\n");
+#ifndef PBL_PACK
+    printf("    -e  start the kernel early: send the modules while it runs, flagging each as it arrives\n");
+    printf("    -r  use RTS/CTS flow control (wired, and the loader built with CONFIG_FLOW=y)\n");
+    printf("    -s  stripe the image over <dev2> (wired to the rpi PL011) as well as <dev>\n");
+    printf("    -t  write a Chrome trace of each boot to <trace-file>\n");
+    printf("    -m  time a boot milestone: the first time <pattern> appears after the triple break (repeatable)\n");
+    printf("    -M  keep the milestone times across runs in <history-file>\n");
+    printf("    -k  decode the binary log with the strings in <kernel-elf> (default: the kernel last sent)\n");
+    printf("    -p  write the folded stacks of the kernel PC samples to <folded-file> at the end of each boot\n");
+    printf("    -u  keep the files the kernel uploads in a new directory in <upload-dir> for each boot\n");
+    printf("    -f  serve the files in <file-dir> to the booted kernel\n");
+    printf("    -w  record the bytes to and from the rpi and the server states in <session-file>\n");
+    printf("    -F  replay a session as fast as the server takes it, not at the recorded pace\n");
+    printf("  With a second config, the boots alternate between the two and their times are compared\n");
+#endif
+    exit(EXIT_FAILURE);
+}
+
+
+//
+// -- Make sure the command line is well formatted
+//    --------------------------------------------
+void ParseCommandLine(int argc, const char * const argv[])
+{
+    int opt;
+
+    while ((opt = getopt(argc, (char * const *)argv, "zerFs:t:m:M:k:p:u:f:w:")) != -1) {
+        switch (opt) {
+        case 'z':
+            compress = true;
+            break;
+
+#ifndef PBL_PACK
+        case 'e':
+            earlyStart = true;
+            break;
+
+        case 's':
+            stripeDev = optarg;
+            break;
+
+        case 'r':
+            rtsCts = true;
+            break;
+
+        case 'F':
+            replayFast = true;
+            break;
+#endif
+
+        case 't':
+            traceName = optarg;
+            break;
+
+        case 'm':
+            if (milestoneCount == MAX_MILESTONES || !*optarg) PrintUsage(argv[0]);
+            milestones[milestoneCount ++].pattern = optarg;
+            break;
+
+        case 'M':
+            historyName = optarg;
+            break;
+
+        case 'k':
+            logElfName = optarg;
+            break;
+
+        case 'p':
+            foldedName = optarg;
+            break;
+
+        case 'u':
+            uploadRoot = optarg;
+            break;
+
+        case 'f':
+            fileRoot = optarg;
+            break;
+
+        case 'w':
+            sessionName = optarg;
+            break;
+
+        default:
+            PrintUsage(argv[0]);
+        }
+    }
+
+#ifdef PBL_PACK
+    if (argc - optind != 2) PrintUsage(argv[0]);
+
+    cfg = argv[optind];
+    packName = argv[optind + 1];
+#else
+    if (argc - optind != 2 && argc - optind != 3) PrintUsage(argv[0]);
+
+    dev = argv[optind];
+    cfg = argv[optind + 1];
+    abCfg[0] = cfg;
+    if (argc - optind == 3) abCfg[1] = argv[optind + 2];
+
+    if (strncmp(dev, "tcp://", 6) == 0) devTransport = XPORT_TCP;
+    else if (strncmp(dev, "rfc2217://", 10) == 0) devTransport = XPORT_RFC2217;
+    else if (strncmp(dev, "replay://", 9) == 0) devTransport = XPORT_REPLAY;
+
+    if (stripeDev && devTransport != XPORT_TTY) {
+        fprintf(stderr, "Striping needs <dev> to be a local tty\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (sessionName && devTransport == XPORT_REPLAY && strcmp(sessionName, dev + 9) == 0) {
+        fprintf(stderr, "A session cannot be recorded over the one being replayed\n");
+        exit(EXIT_FAILURE);
+    }
+#endif
+}
+
+
+//
+// -- Allocate zeroed memory from the arena, adding a chunk when none of the existing ones has room
+//    ---------------------------------------------------------------------------------------------
+void *ArenaAlloc(size_t size)
+{
+    ArenaChunk_t *chunk = arena;
+
+    size = (size + 7) & ~(size_t)7;
+    while (chunk && chunk->size - chunk->used < size) chunk = chunk->next;
+
+    if (!chunk) {
+        size_t chunkSize = (size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE);
+
+        chunk = (ArenaChunk_t *)malloc(sizeof(ArenaChunk_t) + chunkSize);
+        if (!chunk) {
+            fprintf(stderr, "Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+
+        chunk->size = chunkSize;
+        chunk->used = 0;
+        chunk->next = arena;
+        arena = chunk;
+    }
+
+    void *rv = &chunk->data[chunk->used];
+    chunk->used += size;
+    memset(rv, 0, size);
+
+    return rv;
+}
+
+
+//
+// -- Release everything allocated from the arena in one go; the chunks are kept for the next connection
+//    --------------------------------------------------------------------------------------------------
+void ArenaReset(void)
+{
+    for (ArenaChunk_t *chunk = arena; chunk; chunk = chunk->next) chunk->used = 0;
+}
+
+
+//
+// -- The host monotonic clock in usec
+//    --------------------------------
+int64_t NowUsec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+//
+// -- Write a varint to the session file: 7 bits at a time, low first, with the top bit set on all but the last
+//    ---------------------------------------------------------------------------------------------------------
+static void SessionVarint(uint64_t v)
+{
+    do {
+        const uint8_t b = v & 0x7f;
+        v >>= 7;
+        fputc(b | (v ? 0x80 : 0), sessionFile);
+    } while (v);
+}
+
+
+//
+// -- Add a record to the session file, if there is one: bytes to or from the rpi, or (with no data) the new state
+//    or the device being opened
+//    -----------------------------------------------------------------------------------------------------------
+void SessionRecord(SessionRec_t type, const void *data, uint64_t len)
+{
+    // -- checked under the lock, since SessionClose() can run on another thread
+    pthread_mutex_lock(&sessionLock);
+    if (!sessionFile) {
+        pthread_mutex_unlock(&sessionLock);
+        return;
+    }
+
+    const int64_t now = NowUsec();
+    fputc(type, sessionFile);
+    SessionVarint(now - sessionLast);
+    SessionVarint(len);
+    if (data) fwrite(data, 1, len, sessionFile);
+    sessionLast = now;
+
+    // -- the state changes are few, and what comes after one is worth having on disk if the server dies
+    if (type == SESS_STATE) fflush(sessionFile);
+
+    pthread_mutex_unlock(&sessionLock);
+}
+
+
+//
+// -- Finish the session file on the way out
+//    --------------------------------------
+void SessionClose(void)
+{
+    pthread_mutex_lock(&sessionLock);
+    if (sessionFile) fclose(sessionFile);
+    sessionFile = NULL;
+    pthread_mutex_unlock(&sessionLock);
+}
+
+
+//
+// -- Start the session file (-w) with its header
+//    -------------------------------------------
+void SessionOpen(void)
+{
+    SessionHdr_t hdr = { .version = SESSION_VERSION, .hdrSize = sizeof(SessionHdr_t), .baud = DEV_BAUD };
+    struct timespec ts;
+
+    sessionFile = fopen(sessionName, "wb");
+    if (!sessionFile) {
+        perror(sessionName);
+        exit(EXIT_FAILURE);
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    memcpy(hdr.magic, SESSION_MAGIC, sizeof(hdr.magic));
+    hdr.started = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+    if (fwrite(&hdr, sizeof(hdr), 1, sessionFile) != 1) {
+        perror(sessionName);
+        exit(EXIT_FAILURE);
+    }
+
+    sessionLast = NowUsec();
+    atexit(SessionClose);
+}
+
+
+//
+// -- Write all of a buffer to the rpi socket, waiting for room when it is non-blocking; returns false on an error
+//    ------------------------------------------------------------------------------------------------------------
+static bool NetWriteAll(const uint8_t *buf, size_t len)
+{
+    while (len) {
+        ssize_t res = write(fdDev, buf, len);
+
+        if (res == -1) {
+            struct pollfd pfd = { .fd = fdDev, .events = POLLOUT };
+            if (errno != EAGAIN || poll(&pfd, 1, -1) == -1) return false;
+            continue;
+        }
+
+        buf += res;
+        len -= res;
+    }
+
+    return true;
+}
+
+
+//
+// -- Send an RFC 2217 com port setting: IAC SB COM-PORT <code> <value> IAC SE (the value is big endian)
+//    --------------------------------------------------------------------------------------------------
+static bool TelnetComPort(uint8_t code, uint32_t value, int size)
+{
+    uint8_t msg[16] = { TEL_IAC, TEL_SB, TELOPT_COM_PORT, code };
+    int len = 4;
+
+    for (int i = size - 1; i >= 0; i --) {
+        msg[len ++] = (value >> (i * 8)) & 0xff;
+        if (msg[len - 1] == TEL_IAC) msg[len ++] = TEL_IAC;
+    }
+
+    msg[len ++] = TEL_IAC;
+    msg[len ++] = TEL_SE;
+    return NetWriteAll(msg, len);
+}
+
+
+//
+// -- Connect to the serial server named by <dev>; returns the socket, or -1 with errno set when it is worth
+//    trying again (nothing is listening yet, or it cannot be reached right now)
+//    -----------------------------------------------------------------------------------------------------
+static int NetOpen(void)
+{
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res;
+    char host[256];
+    const char *where = strstr(dev, "://") + 3;
+    const char *port = strrchr(where, ':');
+
+    if (!port || port == where || port - where >= (int)sizeof(host)) {
+        fprintf(stderr, "%s: expected <host>:<port>\n", dev);
+        exit(EXIT_FAILURE);
+    }
+
+    // -- [::1]:2000 as well as localhost:2000
+    if (*where == '[' && port[-1] == ']') snprintf(host, sizeof(host), "%.*s", (int)(port - where - 2), where + 1);
+    else snprintf(host, sizeof(host), "%.*s", (int)(port - where), where);
+
+    int err = getaddrinfo(host, port + 1, &hints, &res);
+    if (err == EAI_AGAIN) {
+        errno = EHOSTUNREACH;
+        return -1;
+    } else if (err) {
+        fprintf(stderr, "%s: %s\n", dev, gai_strerror(err));
+        exit(EXIT_FAILURE);
+    }
+
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai && fd == -1; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd != -1 && connect(fd, ai->ai_addr, ai->ai_addrlen) == -1) {
+            err = errno;
+            close(fd);
+            fd = -1;
+            errno = err;
+        }
+    }
+
+    freeaddrinfo(res);
+    if (fd == -1) return -1;
+
+    // -- the handshakes are a byte or 5 at a time and each waits for an answer; the image is corked (DevBulk())
+    const int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    fdDev = fd;
+    telnetState = TELNET_DATA;
+    telnetSbLen = 0;
+
+    // -- with RFC 2217, offer the com port option and binary both ways, and set the line to 115200 8N1 with RTS/CTS
+    //    only with -r; the answers come back in the byte stream and are dealt with there
+    if (devTransport == XPORT_RFC2217) {
+        const uint8_t offer[] = {
+            TEL_IAC, TEL_WILL, TELOPT_COM_PORT,
+            TEL_IAC, TEL_WILL, TELOPT_BINARY, TEL_IAC, TEL_DO, TELOPT_BINARY,
+            TEL_IAC, TEL_WILL, TELOPT_SGA, TEL_IAC, TEL_DO, TELOPT_SGA,
+        };
+
+        if (!NetWriteAll(offer, sizeof(offer)) || !TelnetComPort(CPO_SET_BAUDRATE, DEV_BAUD, 4)
+                || !TelnetComPort(CPO_SET_DATASIZE, 8, 1) || !TelnetComPort(CPO_SET_PARITY, 1, 1)
+                || !TelnetComPort(CPO_SET_STOPSIZE, 1, 1)
+                || !TelnetComPort(CPO_SET_CONTROL, rtsCts ? CPO_FLOW_HARDWARE : CPO_FLOW_NONE, 1)) {
+            err = errno;
+            close(fd);
+            fdDev = -1;
+            errno = err;
+            return -1;
+        }
+    }
+
+    return fd;
+}
+
+
+//
+// -- Take the telnet commands out of bytes from an RFC 2217 server, in place; returns the data bytes left
+//    ----------------------------------------------------------------------------------------------------
+static ssize_t TelnetFilter(uint8_t *buf, ssize_t len)
+{
+    ssize_t out = 0;
+
+    for (ssize_t i = 0; i < len; i ++) {
+        const uint8_t b = buf[i];
+
+        switch (telnetState) {
+        case TELNET_DATA:
+            if (b == TEL_IAC) telnetState = TELNET_IAC;
+            else buf[out ++] = b;
+            break;
+
+        case TELNET_IAC:
+            telnetState = TELNET_DATA;
+            if (b == TEL_IAC) buf[out ++] = b;
+            else if (b == TEL_SB) {
+                telnetState = TELNET_SB;
+                telnetSbLen = 0;
+            } else if (b >= TEL_WILL) {
+                telnetCmd = b;
+                telnetState = TELNET_OPT;
+            }
+            break;
+
+        case TELNET_OPT:
+            telnetState = TELNET_DATA;
+
+            // -- what was offered is already agreed to; refuse anything else the server brings up
+            if (b != TELOPT_BINARY && b != TELOPT_SGA && b != TELOPT_COM_PORT) {
+                if (telnetCmd == TEL_DO || telnetCmd == TEL_WILL) {
+                    const uint8_t no[] = { TEL_IAC, telnetCmd == TEL_DO ? TEL_WONT : TEL_DONT, b };
+                    NetWriteAll(no, sizeof(no));
+                }
+            } else if (b == TELOPT_COM_PORT && (telnetCmd == TEL_DONT || telnetCmd == TEL_WONT)) {
+                fprintf(stderr, "\n%s does not support RFC 2217; the line is as the server has it\n", dev);
+            }
+            break;
+
+        case TELNET_SB:
+            if (b == TEL_IAC) telnetState = TELNET_SB_IAC;
+            else if (telnetSbLen < (int)sizeof(telnetSb)) telnetSb[telnetSbLen ++] = b;
+            break;
+
+        case TELNET_SB_IAC:
+            if (b == TEL_IAC) {
+                if (telnetSbLen < (int)sizeof(telnetSb)) telnetSb[telnetSbLen ++] = b;
+                telnetState = TELNET_SB;
+                break;
+            }
+
+            telnetState = TELNET_DATA;
+            if (b != TEL_SE || telnetSbLen < 6 || telnetSb[0] != TELOPT_COM_PORT) break;
+
+            // -- the only answer worth reporting is the baud rate the port was really set to
+            if (telnetSb[1] == CPO_SERVER + CPO_SET_BAUDRATE) {
+                const uint32_t baud = (telnetSb[2] << 24) | (telnetSb[3] << 16) | (telnetSb[4] << 8) | telnetSb[5];
+                fprintf(stderr, "\n%s: the serial server set the line to %u baud\n", dev, baud);
+            }
+            break;
+        }
+    }
+
+    return out;
+}
+
+
+//
+// -- Read from the rpi, whatever the transport: like read() on the tty, except that the end of a connection is an
+//    error (ECONNRESET), and bytes that were all telnet commands leave nothing to read (EAGAIN when non-blocking)
+//    -------------------------------------------------------------------------------------------------------------
+static ssize_t _DevRead(void *buf, size_t len)
+{
+    ssize_t res = read(fdDev, buf, len);
+
+    if (devTransport == XPORT_TTY) return res;
+    if (res == 0) {
+        errno = ECONNRESET;
+        return -1;
+    }
+
+    if (res == -1 || devTransport != XPORT_RFC2217) return res;
+
+    // -- a read that was all telnet is nothing to read, even on a blocking socket: the caller's select() said there
+    //    was something, and another read() here could wait for the rpi indefinitely
+    res = TelnetFilter((uint8_t *)buf, res);
+    if (res == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    return res;
+}
+
+
+//
+// -- Write to the rpi, whatever the transport; with RFC 2217 every 0xff is doubled, so the write is always whole
+//    (a partial write could not say how much of the caller's buffer went)
+//    -----------------------------------------------------------------------------------------------------------
+static ssize_t _DevWrite(const void *buf, size_t len)
+{
+    if (devTransport != XPORT_RFC2217) return write(fdDev, buf, len);
+
+    const uint8_t *b = (const uint8_t *)buf;
+    uint8_t esc[4096];
+    size_t n = 0;
+
+    for (size_t i = 0; i < len; i ++) {
+        esc[n ++] = b[i];
+        if (b[i] == TEL_IAC) esc[n ++] = TEL_IAC;
+
+        if (n >= sizeof(esc) - 1 || i + 1 == len) {
+            if (!NetWriteAll(esc, n)) return -1;
+            n = 0;
+        }
+    }
+
+    return len;
+}
+
+
+//
+// -- Read from the rpi, and record what was read in the session file
+//    ---------------------------------------------------------------
+ssize_t DevRead(void *buf, size_t len)
+{
+    ssize_t res = _DevRead(buf, len);
+
+    if (res > 0) SessionRecord(SESS_RX, buf, res);
+    return res;
+}
+
+
+//
+// -- Write to the rpi, and record what went in the session file
+//    ----------------------------------------------------------
+ssize_t DevWrite(const void *buf, size_t len)
+{
+    ssize_t res = _DevWrite(buf, len);
+
+    if (res > 0) SessionRecord(SESS_TX, buf, res);
+    return res;
+}
+
+
+//
+// -- Hold back partial segments while the image streams out (TCP_CORK), and push the last of it out when it ends
+//    -----------------------------------------------------------------------------------------------------------
+void DevBulk(bool on)
+{
+    const int cork = on;
+
+    if (devTransport == XPORT_TCP || devTransport == XPORT_RFC2217) {
+        setsockopt(fdDev, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));
+    }
+}
+
+
+//
+// -- Read a varint from a session file; returns false at the end of the file
+//    ------------------------------------------------------------------------
+static bool ReplayVarint(size_t *pos, uint64_t *v)
+{
+    *v = 0;
+
+    for (int shift = 0; *pos < replaySize && shift < 64; shift += 7) {
+        const uint8_t b = replayMap[(*pos) ++];
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return true;
+    }
+
+    return false;
+}
+
+
+//
+// -- Read the next record of a session file; returns false at the end of it (or where it was cut short)
+//    --------------------------------------------------------------------------------------------------
+static bool ReplayNext(size_t *pos, uint8_t *type, int64_t *delta, uint64_t *len, const uint8_t **data)
+{
+    uint64_t d;
+
+    if (*pos >= replaySize) return false;
+    *type = replayMap[(*pos) ++];
+    if (!ReplayVarint(pos, &d) || !ReplayVarint(pos, len)) return false;
+    *delta = d;
+    *data = &replayMap[*pos];
+
+    if (*type == SESS_RX || *type == SESS_TX) {
+        if (*len > replaySize - *pos) return false;
+        *pos += *len;
+    }
+
+    return true;
+}
+
+
+//
+// -- Wait for the server end of the socket pair: to be able to read, or until a time (0 for no limit); returns
+//    false when the server has closed it
+//    ---------------------------------------------------------------------------------------------------------
+static bool ReplayWait(short events, int64_t until)
+{
+    struct pollfd pfd = { .fd = replayFd, .events = events | POLLRDHUP };
+
+    while (1) {
+        const int64_t left = (until ? until - NowUsec() : 0);
+        if (until && left <= 0) return true;
+
+        // -- to the usec: a poll() timeout in ms either spins for the last of it or wakes up to 1 ms late
+        const struct timespec ts = { left / 1000000, (left % 1000000) * 1000 };
+        if (ppoll(&pfd, 1, (until ? &ts : NULL), NULL) > 0) {
+            if (pfd.revents & (POLLHUP | POLLRDHUP | POLLERR)) return false;
+            if (pfd.revents & events) return true;
+        }
+    }
+}
+
+
+//
+// -- The replay thread plays the rpi from the session file: it sends what the rpi sent, at the recorded gaps after
+//    what the server sent before it (or at once with -F), and takes from the server what the server sent,
+//    comparing it with the recording
+//    -------------------------------------------------------------------------------------------------------------
+static void *ReplayThread(void *arg)
+{
+    uint8_t buf[4096];
+    size_t pos = sizeof(SessionHdr_t);
+    uint8_t type;
+    int64_t delta, recorded = 0;
+    uint64_t len;
+    const uint8_t *data;
+    int opens = 0;
+
+    (void)arg;
+
+    // -- the bytes from the rpi are paced from the last thing the server did, not from the start
+    int64_t anchorRec = 0;
+    int64_t anchorNow = NowUsec();
+
+    while (ReplayNext(&pos, &type, &delta, &len, &data)) {
+        recorded += delta;
+
+        // -- the session lost the device here; the replay covers one connection
+        if (type == SESS_OPEN && opens ++) break;
+
+        if (type == SESS_RX) {
+            if (!replayFast && !ReplayWait(0, anchorNow + recorded - anchorRec)) break;
+            if (write(replayFd, data, len) != (ssize_t)len) break;
+            replayStats.rx += len;
+        } else if (type == SESS_TX) {
+            const int64_t limit = REPLAY_STALL_USEC + (replayFast ? 0 : recorded - anchorRec);
+            uint64_t got = 0;
+
+            while (got < len) {
+                if (!ReplayWait(POLLIN, NowUsec() + limit)) break;
+
+                ssize_t n = recv(replayFd, buf, (len - got < sizeof(buf) ? len - got : sizeof(buf)), MSG_DONTWAIT);
+                if (n == -1 && errno == EAGAIN) replayStats.stalled = true;
+                if (n <= 0) break;
+
+                for (ssize_t i = 0; i < n; i ++) {
+                    if (buf[i] == data[got + i]) continue;
+                    if (!replayStats.differ) replayStats.firstDiffer = replayStats.tx + i;
+                    replayStats.differ ++;
+                }
+
+                got += n;
+                replayStats.tx += n;
+            }
+
+            if (got < len) break;
+            anchorRec = recorded;
+            anchorNow = NowUsec();
+        }
+    }
+
+    replayStats.end = NowUsec();
+    shutdown(replayFd, SHUT_RDWR);
+    return NULL;
+}
+
+
+//
+// -- The name of a state, for the replay report
+//    ------------------------------------------
+static const char *StateName(uint32_t s)
+{
+    switch (s) {
+    case OPEN_DEV:          return "OPEN_DEV";
+    case EXIT:              return "EXIT";
+    case REINIT:            return "REINIT";
+    case TTY:               return "TTY";
+    case CONFIG:            return "CONFIG";
+    case CHECK:             return "CHECK";
+    case SEND_SIZE:         return "SEND_SIZE";
+    case SEND_KERNEL:       return "SEND_KERNEL";
+    case SEND_MODULES:      return "SEND_MODULES";
+    case SEND_MBI_SIZE:     return "SEND_MBI_SIZE";
+    case SEND_MBI:          return "SEND_MBI";
+    case SEND_ENTRY:        return "SEND_ENTRY";
+    case RECV_TELEMETRY:    return "RECV_TELEMETRY";
+    case SEND_LATE:         return "SEND_LATE";
+    default:                return "?";
+    }
+}
+
+
+//
+// -- main() has gone to a new state: record it, and in a replay, check it against the recording
+//    ------------------------------------------------------------------------------------------
+void SessionState(State_t s)
+{
+    SessionRecord(SESS_STATE, NULL, s);
+
+    // -- what the server does after the end of the session (it ends the replay) is not compared
+    if (!replayMap || replayStateAt >= replayStateCount) return;
+
+    if (replayStateDiff == -1 && replayStates[replayStateAt] != s) {
+        replayStateDiff = replayStateAt;
+        replayStateWas = s;
+    }
+
+    replayStateAt ++;
+}
+
+
+//
+// -- The replay is over: report how the server did against the recording
+//    --------------------------------------------------------------------
+static void ReplayReport(void)
+{
+    fprintf(stderr, "\nReplay of %s: %llu bytes from the rpi, %llu to it, in %.3f sec (%.3f sec recorded%s)\n", dev + 9,
+            (unsigned long long)replayStats.rx, (unsigned long long)replayStats.tx,
+            (replayStats.end - replayStart) / 1e6, replayRecorded / 1e6, replayFast ? "; as fast as possible" : "");
+
+    if (replayStats.differ) {
+        fprintf(stderr, "  %llu of the bytes to the rpi were not as recorded; the first was byte %lld\n",
+                (unsigned long long)replayStats.differ, (long long)replayStats.firstDiffer);
+    } else {
+        fprintf(stderr, "  the bytes to the rpi were as recorded\n");
+    }
+
+    if (replayStats.stalled) {
+        fprintf(stderr, "  the server stopped sending at byte %llu, where the session went on\n",
+                (unsigned long long)replayStats.tx);
+    }
+
+    if (replayStateDiff != -1) {
+        fprintf(stderr, "  state change %d was to %s; in the session it was to %s\n", replayStateDiff + 1,
+                StateName(replayStateWas), StateName(replayStates[replayStateDiff]));
+    } else if (replayStateAt < replayStateCount) {
+        fprintf(stderr, "  the first %d of the %d state changes in the session were as recorded\n", replayStateAt,
+                replayStateCount);
+    } else {
+        fprintf(stderr, "  the %d state changes were as recorded\n", replayStateCount);
+    }
+}
+
+
+//
+// -- Map the session file to replay, and collect the state changes main() is to go through
+//    -------------------------------------------------------------------------------------
+void ReplayLoad(void)
+{
+    const char *name = dev + 9;
+    struct stat st;
+
+    int fd = open(name, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        perror(name);
+        exit(EXIT_FAILURE);
+    }
+
+    replaySize = st.st_size;
+    replayMap = (uint8_t *)mmap(NULL, replaySize ? replaySize : 1, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    const SessionHdr_t *hdr = (const SessionHdr_t *)replayMap;
+    if (replayMap == MAP_FAILED || replaySize < sizeof(SessionHdr_t) || memcmp(hdr->magic, SESSION_MAGIC, 4) != 0
+            || hdr->version != SESSION_VERSION) {
+        fprintf(stderr, "%s is not a session file\n", name);
+        exit(EXIT_FAILURE);
+    }
+
+    // -- the state changes are checked by main(), as they happen
+    size_t pos = sizeof(SessionHdr_t);
+    uint8_t type;
+    int64_t delta;
+    uint64_t len;
+    const uint8_t *data;
+
+    while (ReplayNext(&pos, &type, &delta, &len, &data)) {
+        replayRecorded += delta;
+        if (type != SESS_STATE) continue;
+
+        replayStates = (uint32_t *)realloc(replayStates, (replayStateCount + 1) * sizeof(uint32_t));
+        if (!replayStates) {
+            fprintf(stderr, "Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+
+        replayStates[replayStateCount ++] = len;
+    }
+}
+
+
+//
+// -- Open the session as the rpi: the server gets one end of a socket pair, and a thread plays the session on the
+//    other.  The second time here, the replay is over (or the server gave up on it), so it is reported and the
+//    server exits.
+//    ------------------------------------------------------------------------------------------------------------
+static int ReplayOpen(void)
+{
+    int sv[2];
+
+    if (replayStarted) {
+        shutdown(replayFd, SHUT_RDWR);
+        pthread_join(replayThread, NULL);
+        close(replayFd);
+        replayFd = -1;
+
+        ReplayReport();
+        exit(EXIT_SUCCESS);
+    }
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) {
+        perror("socketpair()");
+        exit(EXIT_FAILURE);
+    }
+
+    fdDev = sv[0];
+    replayFd = sv[1];
+    replayStarted = true;
+    replayStart = NowUsec();
+
+    if (pthread_create(&replayThread, NULL, ReplayThread, NULL) != 0) {
+        fprintf(stderr, "Unable to start the replay\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return fdDev;
+}
+
+
+//
+// -- Build the CRC-32 lookup table (the same polynomial as zlib)
+//    -----------------------------------------------------------
+void Crc32Init(void)
+{
+    for (uint32_t i = 0; i < 256; i ++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k ++) c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+        crcTable[i] = c;
+    }
+}
+
+
+//
+// -- Continue a CRC-32 calculation over a block of bytes
+//    ---------------------------------------------------
+uint32_t Crc32(uint32_t crc, const uint8_t *buf, int len)
+{
+    crc = ~crc;
+    while (len --) crc = crcTable[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+
+//
+// -- Back off while a ring is full or empty: spin briefly, then sleep so a slow tty does not burn a cpu
+//    --------------------------------------------------------------------------------------------------
+static void RingBackoff(int *spins)
+{
+    if (++*spins < 64) {
+        sched_yield();
+    } else {
+        struct timespec ts = {0, 200000};
+        nanosleep(&ts, NULL);
+    }
+}
+
+
+//
+// -- Push a buffer onto a ring -- called only by the ring's producer; waits for room
+//    -------------------------------------------------------------------------------
+void RingPush(Ring_t *ring, PipeBuf_t *buf)
+{
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    int spins = 0;
+
+    while (head - atomic_load_explicit(&ring->tail, memory_order_acquire) == RING_SLOTS) RingBackoff(&spins);
+
+    ring->slot[head & (RING_SLOTS - 1)] = buf;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+
+//
+// -- Pop a buffer from a ring -- called only by the ring's consumer; waits for a buffer
+//    ----------------------------------------------------------------------------------
+PipeBuf_t *RingPop(Ring_t *ring)
+{
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    int spins = 0;
+
+    while (atomic_load_explicit(&ring->head, memory_order_acquire) == tail) RingBackoff(&spins);
+
+    PipeBuf_t *rv = ring->slot[tail & (RING_SLOTS - 1)];
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return rv;
+}
+
+
+//
+// -- Is a block all zeros?
+//    ---------------------
+static bool IsZero(const uint8_t *buf, int len)
+{
+    while (len --) if (*buf++) return false;
+    return true;
+}
+
+
+//
+// -- Emit one LZ sequence (literals, then an optional match); returns false if it will not fit
+//    -----------------------------------------------------------------------------------------
+static bool LzEmit(uint8_t *dst, int *op, int max, const uint8_t *lit, int litLen, int offset, int matchLen)
+{
+    int need = 1 + (litLen / 255 + 1) + litLen + (matchLen ? 2 + (matchLen / 255 + 1) : 0);
+    uint8_t *out = dst + *op;
+
+    if (*op + need > max) return false;
+
+    int lCode = (litLen >= 15 ? 15 : litLen);
+    int mCode = (matchLen ? (matchLen - 4 >= 15 ? 15 : matchLen - 4) : 0);
+    *out++ = (lCode << 4) | mCode;
+
+    if (lCode == 15) {
+        int rem = litLen - 15;
+        while (rem >= 255) { *out++ = 255; rem -= 255; }
+        *out++ = rem;
+    }
+
+    memcpy(out, lit, litLen);
+    out += litLen;
+
+    if (matchLen) {
+        *out++ = offset & 0xff;
+        *out++ = (offset >> 8) & 0xff;
+
+        if (mCode == 15) {
+            int rem = matchLen - 4 - 15;
+            while (rem >= 255) { *out++ = 255; rem -= 255; }
+            *out++ = rem;
+        }
+    }
+
+    *op = out - dst;
+    return true;
+}
+
+
+//
+// -- LZ compress a block: LZ4-style sequences with no end-of-block rules (the last sequence is literals only)
+//    -------------------------------------------------------------------------------------------------------
+int LzCompress(const uint8_t *src, int len, uint8_t *dst, int max)
+{
+    uint16_t table[1 << LZ_HASH_BITS];      // position + 1 of the last time each hash was seen
+    int ip = 0, anchor = 0, op = 0;
+
+    memset(table, 0, sizeof(table));
+
+    while (ip + 4 <= len) {
+        uint32_t seq;
+        memcpy(&seq, &src[ip], 4);
+
+        uint32_t h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+        int ref = table[h] - 1;
+        table[h] = ip + 1;
+
+        if (ref < 0 || memcmp(&src[ref], &src[ip], 4) != 0) {
+            ip ++;
+            continue;
+        }
+
+        int matchLen = 4;
+        while (ip + matchLen < len && src[ref + matchLen] == src[ip + matchLen]) matchLen ++;
+
+        if (!LzEmit(dst, &op, max, &src[anchor], ip - anchor, ip - ref, matchLen)) return 0;
+
+        ip += matchLen;
+        anchor = ip;
+    }
+
+    if (!LzEmit(dst, &op, max, &src[anchor], len - anchor, 0, 0)) return 0;
+    return op;
+}
+
+
+//
+// -- LZ decompress a block (the same format as LzCompress()); returns the bytes decoded or -1 if it is corrupt
+//    ---------------------------------------------------------------------------------------------------------
+int LzDecompress(const uint8_t *src, int len, uint8_t *dst, int max)
+{
+    const uint8_t *end = src + len;
+    int op = 0;
+
+    while (src < end) {
+        uint8_t token = *src++;
+        int count = token >> 4;
+
+        if (count == 15) {
+            do { if (src == end) return -1; count += *src; } while (*src++ == 255);
+        }
+
+        // -- the literals
+        if (count > end - src || op + count > max) return -1;
+        memcpy(&dst[op], src, count);
+        src += count;
+        op += count;
+
+        // -- the last sequence is only literals
+        if (src == end) break;
+        if (end - src < 2) return -1;
+
+        int offset = src[0] | (src[1] << 8);
+        src += 2;
+
+        count = (token & 0x0f) + 4;
+        if ((token & 0x0f) == 15) {
+            do { if (src == end) return -1; count += *src; } while (*src++ == 255);
+        }
+
+        // -- the match, which may overlap itself
+        if (offset == 0 || offset > op || op + count > max) return -1;
+        while (count --) {
+            dst[op] = dst[op - offset];
+            op ++;
+        }
+    }
+
+    return op;
+}
+
+
+//
+// -- Size the table of pages already sent for an image; sized at twice the number of pages
+//    -------------------------------------------------------------------------------------
+void DedupInit(uint32_t bytes)
+{
+    uint32_t slots = 64;
+
+    while (slots < 2 * (bytes / BLOCK_SIZE + 1)) slots <<= 1;
+
+    dedupTable = (DedupEntry_t *)ArenaAlloc(slots * sizeof(DedupEntry_t));
+    dedupMask = slots - 1;
+}
+
+
+//
+// -- Look up a page in the table of pages already sent; return its address or add it and return 0
+//    ---------------------------------------------------------------------------------------------
+static uint32_t DedupLookup(uint32_t addr, const uint8_t *page, uint32_t crc)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+    for (int i = 0; i < BLOCK_SIZE; i ++) hash = (hash ^ page[i]) * 0x100000001b3ull;
+
+    for (uint32_t slot = (uint32_t)hash & dedupMask; ; slot = (slot + 1) & dedupMask) {
+        DedupEntry_t *ent = &dedupTable[slot];
+
+        if (ent->addr == 0) {
+            ent->hash = hash;
+            ent->crc = crc;
+            ent->addr = addr;
+            return 0;
+        }
+
+        if (ent->hash == hash && ent->crc == crc) return ent->addr;
+    }
+}
+
+
+//
+// -- Frame one block of the image for the wire, returning the number of bytes added to out
+//    -------------------------------------------------------------------------------------
+static int FrameBlock(uint8_t *out, uint32_t addr, const uint8_t *raw, int len)
+{
+    BlockHdr_t hdr;
+    uint8_t *payload = out + sizeof(BlockHdr_t);
+    uint32_t src = 0;
+    int wire = 0;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.addr = addr;
+    hdr.len = len;
+    hdr.crc = Crc32(0, raw, len);
+
+    if (IsZero(raw, len)) {
+        hdr.op = BLK_FILL;
+    } else if (pipeDedup && len == BLOCK_SIZE && (src = DedupLookup(addr, raw, hdr.crc)) != 0) {
+        // -- the rpi already has this page; it verifies the copy against the crc like any other block
+        hdr.op = BLK_COPY;
+        memcpy(payload, &src, sizeof(src));
+        wire = sizeof(src);
+        dedupPages ++;
+    } else if (compress && (wire = LzCompress(raw, len, payload, len - 1)) > 0) {
+        hdr.op = BLK_LZ;
+    } else {
+        hdr.op = BLK_DATA;
+        memcpy(payload, raw, len);
+        wire = len;
+    }
+
+    hdr.wireLen = wire;
+    memcpy(out, &hdr, sizeof(hdr));
+
+    return sizeof(BlockHdr_t) + wire;
+}
+
+
+//
+// -- Pipeline stage 1: materialize the planned extents into buffers of contiguous addresses
+//    --------------------------------------------------------------------------------------
+void *PipeReader(void *arg)
+{
+    (void)arg;
+
+    while (1) {
+        sem_wait(&readerGo);
+
+        PipeBuf_t *buf = RingPop(&readFree);
+        buf->addr = (pipeFirst < pipeLast ? plan[pipeFirst].addr : 0);
+        buf->len = 0;
+        buf->framed = false;
+        buf->mark = false;
+        buf->last = false;
+        buf->ptr = buf->data;
+
+        for (int i = pipeFirst; i < pipeLast && !atomic_load(&pipeError); i ++) {
+            Extent_t *ext = &plan[i];
+            uint32_t done = 0;
+
+            // -- a module mark goes in a buffer of its own, after everything before it
+            if (ext->type == EXT_MARK) {
+                if (buf->len) {
+                    RingPush(&readRing, buf);
+                    buf = RingPop(&readFree);
+                }
+
+                buf->addr = ext->offset;
+                buf->len = 0;
+                buf->framed = false;
+                buf->mark = true;
+                buf->last = false;
+                buf->ptr = buf->data;
+                RingPush(&readRing, buf);
+
+                buf = RingPop(&readFree);
+                buf->addr = 0;
+                buf->len = 0;
+                buf->framed = false;
+                buf->mark = false;
+                buf->last = false;
+                buf->ptr = buf->data;
+                continue;
+            }
+
+            // -- pre-framed extents are passed along in place, without a copy
+            if (ext->type == EXT_MEM) {
+                while (done < ext->len) {
+                    if (buf->len) {
+                        RingPush(&readRing, buf);
+                        buf = RingPop(&readFree);
+                    }
+
+                    buf->addr = ext->addr;
+                    buf->len = (ext->len - done > PIPE_BUF_SIZE ? PIPE_BUF_SIZE : ext->len - done);
+                    buf->framed = true;
+                    buf->mark = false;
+                    buf->last = false;
+                    buf->ptr = packMap + ext->offset + done;
+                    done += buf->len;
+                }
+
+                continue;
+            }
+
+            if (ext->type == EXT_FILE && lseek(ext->fd, ext->offset, SEEK_SET) == -1) {
+                perror(ext->name);
+                atomic_store(&pipeError, true);
+                break;
+            }
+
+            while (done < ext->len && !atomic_load(&pipeError)) {
+                // -- a full buffer, a pre-framed buffer, or a gap in the addresses starts a new buffer
+                if (buf->len == PIPE_BUF_SIZE || buf->framed || buf->addr + buf->len != ext->addr + done) {
+                    if (buf->len) {
+                        RingPush(&readRing, buf);
+                        buf = RingPop(&readFree);
+                    }
+
+                    buf->addr = ext->addr + done;
+                    buf->len = 0;
+                    buf->framed = false;
+                    buf->mark = false;
+                    buf->last = false;
+                    buf->ptr = buf->data;
+                }
+
+                int want = PIPE_BUF_SIZE - buf->len;
+                if ((uint32_t)want > ext->len - done) want = ext->len - done;
+
+                if (ext->type == EXT_ZERO) {
+                    memset(&buf->data[buf->len], 0, want);
+                } else {
+                    int bytes = read(ext->fd, &buf->data[buf->len], want);
+                    if (bytes <= 0) {
+                        perror(ext->name);
+                        atomic_store(&pipeError, true);
+                        break;
+                    }
+
+                    want = bytes;
+                }
+
+                buf->len += want;
+                done += want;
+            }
+        }
+
+        // -- always terminate the run so the downstream stages finish, even on error
+        buf->last = true;
+        RingPush(&readRing, buf);
+    }
+
+    return NULL;
+}
+
+
+//
+// -- Get an empty framed buffer from the writer
+//    ------------------------------------------
+static PipeBuf_t *XformGet(void)
+{
+    PipeBuf_t *out = RingPop(&xformFree);
+
+    out->len = 0;
+    out->raw = 0;
+    out->framed = true;
+    out->mark = false;
+    out->last = false;
+    out->ptr = out->data;
+
+    return out;
+}
+
+
+//
+// -- Pipeline stage 2: cut the image into blocks (on 4K address boundaries) and frame them for the wire
+//    --------------------------------------------------------------------------------------------------
+void *PipeTransform(void *arg)
+{
+    (void)arg;
+
+    while (1) {
+        sem_wait(&xformGo);
+        uint32_t wireOffset = 0;
+        imageCrc = 0;
+        blocksSent = 0;
+        dedupPages = 0;
+
+        PipeBuf_t *out = XformGet();
+
+        while (1) {
+            PipeBuf_t *in = RingPop(&readRing);
+            bool last = in->last;
+
+            if (in->framed) {
+                // -- a pack file was framed offline; hand its memory straight to the writer
+                if (out->len) {
+                    RingPush(&xformRing, out);
+                    out = XformGet();
+                }
+
+                out->ptr = in->ptr;
+                out->len = in->len;
+                out->raw = in->len;
+            } else if (in->mark) {
+                // -- everything for the module is ahead of this on the wire; the rpi flags it as ready
+                if (out->ptr != out->data || out->len + sizeof(BlockHdr_t) > sizeof(out->data)) {
+                    RingPush(&xformRing, out);
+                    out = XformGet();
+                }
+
+                BlockHdr_t mark;
+                memset(&mark, 0, sizeof(mark));
+                mark.op = BLK_MARK;
+                mark.addr = in->addr;
+                memcpy(&out->data[out->len], &mark, sizeof(mark));
+                out->len += sizeof(mark);
+            } else {
+                imageCrc = Crc32(imageCrc, in->ptr, in->len);
+
+                for (int pos = 0; pos < in->len; ) {
+                    uint32_t addr = in->addr + pos;
+                    int n = BLOCK_SIZE - (addr & (BLOCK_SIZE - 1));
+                    if (n > in->len - pos) n = in->len - pos;
+
+                    if (out->ptr != out->data || out->len + sizeof(BlockHdr_t) + n > sizeof(out->data)) {
+                        RingPush(&xformRing, out);
+                        out = XformGet();
+                    }
+
+                    int wire = FrameBlock(&out->data[out->len], addr, &in->ptr[pos], n);
+
+                    if (packIndex) {
+                        PackIndex_t *idx = &packIndex[blocksSent];
+                        idx->addr = addr;
+                        idx->len = n;
+                        idx->crc = Crc32(0, &in->ptr[pos], n);
+                        idx->offset = wireOffset;
+                        idx->wireLen = wire;
+                    }
+
+                    wireOffset += wire;
+                    out->len += wire;
+                    out->raw += n;
+                    blocksSent ++;
+                    pos += n;
+                }
+            }
+
+            RingPush(&readFree, in);
+
+            if (last) {
+                // -- a live image needs its end marker; a pack file already has one
+                if (!planFramed) {
+                    if (out->ptr != out->data || out->len + sizeof(BlockHdr_t) > sizeof(out->data)) {
+                        RingPush(&xformRing, out);
+                        out = XformGet();
+                    }
+
+                    BlockHdr_t end;
+                    memset(&end, 0, sizeof(end));
+                    end.op = BLK_END;
+                    end.len = blocksSent;
+                    memcpy(&out->data[out->len], &end, sizeof(end));
+                    out->len += sizeof(end);
+                }
+
+                out->last = true;
+                RingPush(&xformRing, out);
+                break;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+
+//
+// -- Write what the striped ttys have room for, waiting (up to `wait` ms) for room first; returns false on an error
+//    --------------------------------------------------------------------------------------------------------------
+static bool StripePush(int wait)
+{
+    struct pollfd pfd[2];
+    int n = 0;
+
+    for (int port = 0; port < 2; port ++) {
+        if (stripeOut[port].sent == stripeOut[port].len) continue;
+
+        pfd[n].fd = (port ? fdStripe : fdDev);
+        pfd[n].events = POLLOUT;
+        n ++;
+    }
+
+    if (n && poll(pfd, n, wait) == -1) {
+        perror("poll() on the striped ttys");
+        return false;
+    }
+
+    for (int port = 0; port < 2; port ++) {
+        StripeOut_t *out = &stripeOut[port];
+        if (out->sent == out->len) continue;
+
+        int res = (port ? write(fdStripe, &out->data[out->sent], out->len - out->sent)
+                : DevWrite(&out->data[out->sent], out->len - out->sent));
+        if (res == -1) {
+            if (errno == EAGAIN) continue;
+            perror(port ? stripeDev : dev);
+            return false;
+        }
+
+        out->sent += res;
+        stripeBytes[port] += res;
+        atomic_fetch_add(&pipeBytesSent, res);
+        if (out->sent == out->len) out->sent = out->len = 0;
+    }
+
+    return true;
+}
+
+
+//
+// -- Write framed bytes striped over both ttys: each block goes whole to one of them, numbered so that the rpi can
+//    put them back in order.  A tty only gets the next block once it has taken all of its last one, and a tty only
+//    takes bytes as it puts them on the wire, so each one gets blocks in proportion to how fast it really is.  The
+//    bytes are any stretch of the framed image, so a block can straddle 2 calls.
+//    -------------------------------------------------------------------------------------------------------------
+static bool StripeWrite(const uint8_t *ptr, int len)
+{
+    while (len) {
+        if (stripeLeft) {
+            StripeOut_t *out = &stripeOut[stripePort];
+            uint32_t n = (stripeLeft < (uint32_t)len ? stripeLeft : (uint32_t)len);
+
+            memcpy(&out->data[out->len], ptr, n);
+            out->len += n;
+            ptr += n;
+            len -= n;
+            stripeLeft -= n;
+            continue;
+        }
+
+        int n = sizeof(BlockHdr_t) - stripeHdrLen;
+        if (n > len) n = len;
+        memcpy(&stripeHdr[stripeHdrLen], ptr, n);
+        stripeHdrLen += n;
+        ptr += n;
+        len -= n;
+        if (stripeHdrLen < (int)sizeof(BlockHdr_t)) break;
+
+        BlockHdr_t hdr;
+        memcpy(&hdr, stripeHdr, sizeof(hdr));
+        if (hdr.wireLen > sizeof(stripeOut[0].data) - sizeof(hdr)) {
+            fprintf(stderr, "A block of %u bytes is too big to stripe\n", hdr.wireLen);
+            return false;
+        }
+
+        // -- wait for a tty to take everything it was given
+        while (stripeOut[0].len && stripeOut[1].len) {
+            if (!StripePush(-1)) return false;
+        }
+
+        stripePort = (stripeOut[0].len ? 1 : 0);
+        hdr.seq = stripeSeq ++;
+        stripeHdrLen = 0;
+        stripeLeft = hdr.wireLen;
+
+        memcpy(&stripeOut[stripePort].data[stripeOut[stripePort].len], &hdr, sizeof(hdr));
+        stripeOut[stripePort].len += sizeof(hdr);
+    }
+
+    return StripePush(0);
+}
+
+
+//
+// -- Finish a striped run: write everything still waiting for either tty
+//    -------------------------------------------------------------------
+static bool StripeFlush(void)
+{
+    while (stripeOut[0].len || stripeOut[1].len) {
+        if (!StripePush(-1)) return false;
+    }
+
+    return true;
+}
+
+
+//
+// -- Report how the last run of the pipeline was split between the ttys
+//    ------------------------------------------------------------------
+void StripeReport(void)
+{
+    if (!stripeActive) return;
+
+    const double elapsed = (NowUsec() - stripeStart) / 1e6;
+    const uint64_t total = stripeBytes[0] + stripeBytes[1];
+
+    fprintf(stderr, "  striped: %llu bytes (%.0f%%) on %s and %llu bytes (%.0f%%) on %s; %.1f KB/s together\n",
+            (unsigned long long)stripeBytes[0], total ? 100.0 * stripeBytes[0] / total : 0, dev,
+            (unsigned long long)stripeBytes[1], total ? 100.0 * stripeBytes[1] / total : 0, stripeDev,
+            elapsed > 0 ? total / elapsed / 1024 : 0);
+}
+
+
+//
+// -- Pipeline stage 3: keep the tty output queue full, recycling each buffer once written
+//    ------------------------------------------------------------------------------------
+void *PipeWriter(void *arg)
+{
+    (void)arg;
+
+    while (1) {
+        sem_wait(&writerGo);
+        if (pipeFd == fdDev) DevBulk(true);
+
+        while (1) {
+            PipeBuf_t *buf = RingPop(&xformRing);
+            bool last = buf->last;
+            int pos = 0;
+
+            // -- the striped ttys are written without blocking (PipeStart() set that), so neither holds up the other
+            if (stripeActive && !atomic_load(&pipeError)) {
+                if (!StripeWrite(buf->ptr, buf->len) || (last && !StripeFlush())) atomic_store(&pipeError, true);
+
+                pos = buf->len;
+            }
+
+            // -- after an error, keep draining so that every buffer makes it back to the transform
+            while (pos < buf->len && !atomic_load(&pipeError)) {
+                int res = (pipeFd == fdDev ? DevWrite(&buf->ptr[pos], buf->len - pos)
+                        : write(pipeFd, &buf->ptr[pos], buf->len - pos));
+                if (res == -1) {
+                    perror("pipeline write() to dev");
+                    atomic_store(&pipeError, true);
+                    break;
+                }
+
+                pos += res;
+                atomic_fetch_add(&pipeBytesSent, res);
+            }
+
+            atomic_fetch_add(&pipeRawSent, buf->raw);
+            RingPush(&xformFree, buf);
+            if (last) break;
+        }
+
+        if (pipeFd == fdDev) DevBulk(false);
+        sem_post(&pipeDone);
+    }
+
+    return NULL;
+}
+
+
+//
+// -- Create the pipeline stages once; no allocations are made in the send path after this
+//    ------------------------------------------------------------------------------------
+void PipeInit(void)
+{
+    pthread_t tid;
+
+    Crc32Init();
+
+    sem_init(&readerGo, 0, 0);
+    sem_init(&xformGo, 0, 0);
+    sem_init(&writerGo, 0, 0);
+    sem_init(&pipeDone, 0, 0);
+
+    for (int i = 0; i < PIPE_BUF_COUNT; i ++) {
+        RingPush(&readFree, &readBufs[i]);
+        RingPush(&xformFree, &xformBufs[i]);
+    }
+
+    if (pthread_create(&tid, NULL, PipeReader, NULL) != 0 || pthread_detach(tid) != 0
+            || pthread_create(&tid, NULL, PipeTransform, NULL) != 0 || pthread_detach(tid) != 0
+            || pthread_create(&tid, NULL, PipeWriter, NULL) != 0 || pthread_detach(tid) != 0) {
+        fprintf(stderr, "Unable to start the send pipeline\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+//
+// -- Start the pipeline sending the extents first..last-1 of the plan; the caller waits with PipeWait()
+//    -------------------------------------------------------------------------------------------------
+void PipeStart(int first, int last)
+{
+    pipeFirst = first;
+    pipeLast = last;
+    atomic_store(&pipeError, false);
+    atomic_store(&pipeBytesSent, 0);
+    atomic_store(&pipeRawSent, 0);
+
+    // -- every run starts with no pages sent, and its blocks numbered from 0; the early-start module run copies
+    //    nothing, since the kernel may already be changing a module the loader has marked ready
+    pipeDedup = (dedupTable != NULL && !(lateModules && first == planKernelCount));
+    if (pipeDedup) memset(dedupTable, 0, (dedupMask + 1) * sizeof(DedupEntry_t));
+    stripeSeq = 0;
+    stripeLeft = 0;
+    stripeHdrLen = 0;
+    stripeOut[0].len = stripeOut[0].sent = 0;
+    stripeOut[1].len = stripeOut[1].sent = 0;
+    stripeBytes[0] = stripeBytes[1] = 0;
+    stripeStart = NowUsec();
+
+    // -- a striped run writes fdDev without blocking; the mode is set once for the whole run, here on the main
+    //    thread (which reads fdDev meanwhile), and PipeWait() puts it back when the run is done
+    if (stripeActive && pipeFd == fdDev && fcntl(fdDev, F_SETFL, O_NONBLOCK) == -1) {
+        perror("fcntl()");
+        atomic_store(&pipeError, true);
+    }
+
+    sem_post(&writerGo);
+    sem_post(&xformGo);
+    sem_post(&readerGo);
+}
+
+
+//
+// -- Wait up to 100ms for the pipeline to complete; returns true when it has
+//    -----------------------------------------------------------------------
+bool PipeWait(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += 100000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec ++;
+        ts.tv_nsec -= 1000000000;
+    }
+
+    if (sem_timedwait(&pipeDone, &ts) != 0) return false;
+
+    if (stripeActive && pipeFd == fdDev && fcntl(fdDev, F_SETFL, 0) == -1) {
+        perror("fcntl()");
+        atomic_store(&pipeError, true);
+    }
+
+    return true;
+}
+
+
+//
+// -- Add an extent to the image plan
+//    -------------------------------
+bool PlanAdd(ExtentType_t type, int fd, off_t offset, uint32_t addr, uint32_t len, const char *name)
+{
+    if (len == 0 && type != EXT_MARK) return true;
+
+    if (planCount == planCap) {
+        fprintf(stderr, "The image has too many sections to send\n");
+        return false;
+    }
+
+    plan[planCount].type = type;
+    plan[planCount].fd = fd;
+    plan[planCount].offset = offset;
+    plan[planCount].addr = addr;
+    plan[planCount].len = len;
+    plan[planCount].name = name;
+    planCount ++;
+
+    return true;
+}
+
+//
+// -- The regularized incomplete beta function I_x(a,b), by its continued fraction (modified Lentz)
+//    ---------------------------------------------------------------------------------------------
+static double IncompleteBeta(double a, double b, double x)
+{
+    if (x <= 0) return 0;
+    if (x >= 1) return 1;
+
+    // -- the continued fraction converges quickly only on this side; use the symmetry otherwise
+    if (x > (a + 1) / (a + b + 2)) return 1 - IncompleteBeta(b, a, 1 - x);
+
+    const double TINY = 1e-300;
+    const double front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) + a * log(x) + b * log(1 - x)) / a;
+    double c = 1;
+    double d = 1 - (a + b) * x / (a + 1);
+    if (fabs(d) < TINY) d = TINY;
+    d = 1 / d;
+    double f = d;
+
+    for (int m = 1; m <= 200; m ++) {
+        for (int odd = 0; odd < 2; odd ++) {
+            double num = odd ? -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1))
+                             : m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m));
+
+            d = 1 + num * d;
+            if (fabs(d) < TINY) d = TINY;
+            c = 1 + num / c;
+            if (fabs(c) < TINY) c = TINY;
+            d = 1 / d;
+            f *= c * d;
+        }
+
+        if (fabs(c * d - 1) < 1e-12) break;
+    }
+
+    return front * f;
+}
+
+
+//
+// -- The two-sided p-value of Student's t with df degrees of freedom
+//    ---------------------------------------------------------------
+static double StudentP(double t, double df)
+{
+    return IncompleteBeta(df / 2, 0.5, df / (df + t * t));
+}
+
+
+//
+// -- The critical t for a two-sided test at AB_ALPHA, found by bisection
+//    -------------------------------------------------------------------
+static double StudentCritical(double df)
+{
+    double lo = 0, hi = 1000;
+
+    for (int i = 0; i < 100; i ++) {
+        double mid = (lo + hi) / 2;
+        if (StudentP(mid, df) > AB_ALPHA) lo = mid;
+        else hi = mid;
+    }
+
+    return (lo + hi) / 2;
+}
+
+
+//
+// -- Add a sample (usec) to one side of an A/B metric (Welford, so the variance is stable)
+//    -------------------------------------------------------------------------------------
+void AbRecord(int metric, int64_t usec)
+{
+    if (!abCfg[1]) return;
+
+    AbMetric_t *m = &abMetrics[metric];
+    const int side = abSide;
+    const double x = usec / 1000.0;
+    const double delta = x - m->mean[side];
+
+    m->n[side] ++;
+    m->mean[side] += delta / m->n[side];
+    m->m2[side] += delta * (x - m->mean[side]);
+}
+
+
+//
+// -- Compare the 2 sides of every metric that has enough runs: the means with their confidence intervals, and
+//    Welch's t-test on the difference
+//    --------------------------------------------------------------------------------------------------------
+void AbReport(void)
+{
+    bool header = false;
+
+    for (int i = 0; i <= milestoneCount; i ++) {
+        const AbMetric_t *m = &abMetrics[i];
+        double var[2], ci[2];
+
+        if (m->n[0] < AB_MIN_RUNS || m->n[1] < AB_MIN_RUNS) continue;
+
+        if (!header) {
+            fprintf(stderr, "\nA/B comparison (A = %s, B = %s; msec, %.0f%% confidence):\n", abCfg[0], abCfg[1],
+                    100 * (1 - AB_ALPHA));
+            fprintf(stderr, "  %-24s %22s %22s %24s %8s %8s\n", "metric", "A", "B", "B - A", "t", "p");
+            header = true;
+        }
+
+        for (int s = 0; s < 2; s ++) {
+            var[s] = m->m2[s] / (m->n[s] - 1);
+            ci[s] = StudentCritical(m->n[s] - 1) * sqrt(var[s] / m->n[s]);
+        }
+
+        // -- Welch: the variances are not assumed to be equal
+        const double va = var[0] / m->n[0];
+        const double vb = var[1] / m->n[1];
+        const double diff = m->mean[1] - m->mean[0];
+        const double se = sqrt(va + vb);
+        char line[3][32];
+
+        snprintf(line[0], sizeof(line[0]), "%.3f +/- %.3f (%d)", m->mean[0], ci[0], m->n[0]);
+        snprintf(line[1], sizeof(line[1]), "%.3f +/- %.3f (%d)", m->mean[1], ci[1], m->n[1]);
+
+        if (se == 0) {
+            snprintf(line[2], sizeof(line[2]), "%+.3f", diff);
+            fprintf(stderr, "  %-24.24s %22s %22s %24s %8s %8s\n", i ? milestones[i - 1].pattern : "transfer",
+                    line[0], line[1], line[2], "-", "-");
+            continue;
+        }
+
+        const double df = (va + vb) * (va + vb) / (va * va / (m->n[0] - 1) + vb * vb / (m->n[1] - 1));
+        const double t = diff / se;
+        const double p = StudentP(t, df);
+
+        snprintf(line[2], sizeof(line[2]), "%+.3f +/- %.3f", diff, StudentCritical(df) * se);
+        fprintf(stderr, "  %-24.24s %22s %22s %24s %8.2f %8.4f%s\n", i ? milestones[i - 1].pattern : "transfer",
+                line[0], line[1], line[2], t, p, p < AB_ALPHA ? "  *" : "");
+    }
+}
+
+
+//
+// -- Move on to the next boot: in A/B mode, alternate the configs
+//    ------------------------------------------------------------
+void AbNext(void)
+{
+    if (!abCfg[1]) return;
+
+    abSide = abBoots ++ % 2;
+    cfg = abCfg[abSide];
+    fprintf(stderr, "A/B: this boot is %c (%s)\n", 'A' + abSide, cfg);
+}
+
+
+//
+// -- Add a time to the history of a milestone
+//    ----------------------------------------
+void MilestoneRecord(Milestone_t *m, int64_t usec)
+{
+    if (m->count == m->cap) {
+        m->cap = m->cap ? m->cap * 2 : 64;
+        m->history = (int64_t *)realloc(m->history, m->cap * sizeof(int64_t));
+
+        if (!m->history) {
+            perror("milestone history");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    m->history[m->count ++] = usec;
+}
+
+
+//
+// -- Start a run: the triple break was just seen
+//    -------------------------------------------
+void MilestoneArm(void)
+{
+    for (int i = 0; i < milestoneCount; i ++) {
+        milestones[i].pos = 0;
+        milestones[i].hit = -1;
+    }
+
+    milestonesArmed = (milestoneCount != 0);
+}
+
+
+//
+// -- Compare 2 times for qsort()
+//    ---------------------------
+static int CompareUsec(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+
+//
+// -- Print the percentiles and a one-line histogram of all the times for a milestone
+//    -------------------------------------------------------------------------------
+static void MilestoneHistogram(const Milestone_t *m)
+{
+    static const char shade[] = " .:-=+*#%@";
+    enum { BUCKETS = 20 };
+    int bucket[BUCKETS];
+    int most = 0;
+
+    int64_t *sorted = (int64_t *)malloc(m->count * sizeof(int64_t));
+    if (!sorted) {
+        perror("milestone report");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(sorted, m->history, m->count * sizeof(int64_t));
+    qsort(sorted, m->count, sizeof(int64_t), CompareUsec);
+
+    // -- nearest rank percentiles
+    const int pct[3] = { 50, 90, 99 };
+    for (int p = 0; p < 3; p ++) {
+        int rank = (pct[p] * m->count + 99) / 100;
+        fprintf(stderr, "%10.3f ", sorted[rank - 1] / 1000.0);
+    }
+
+    const int64_t lo = sorted[0];
+    const int64_t range = sorted[m->count - 1] - lo + 1;
+
+    memset(bucket, 0, sizeof(bucket));
+    for (int j = 0; j < m->count; j ++) {
+        int b = (sorted[j] - lo) * BUCKETS / range;
+        if (++ bucket[b] > most) most = bucket[b];
+    }
+
+    fprintf(stderr, "%6d  [", m->count);
+    for (int b = 0; b < BUCKETS; b ++) {
+        fputc(shade[bucket[b] ? 1 + bucket[b] * (int)(sizeof(shade) - 3) / most : 0], stderr);
+    }
+    fprintf(stderr, "] %.3f..%.3f\n", lo / 1000.0, sorted[m->count - 1] / 1000.0);
+
+    free(sorted);
+}
+
+
+//
+// -- Finish a run: record the milestones it saw and report each one against all the runs so far
+//    -------------------------------------------------------------------------------------------
+void MilestoneFinish(void)
+{
+    int hits = 0;
+
+    if (!milestonesArmed) return;
+    milestonesArmed = false;
+
+    for (int i = 0; i < milestoneCount; i ++) if (milestones[i].hit >= 0) hits ++;
+    if (!hits) return;                      // -- the boot never got far enough to count
+
+    FILE *fp = historyName ? fopen(historyName, "a") : NULL;
+    if (historyName && !fp) perror(historyName);
+
+    milestoneRuns ++;
+    fprintf(stderr, "\nBoot milestones (run %d; msec after the triple break):\n", milestoneRuns);
+    fprintf(stderr, "  %-32s %10s %10s %10s %10s %6s  histogram (min..max)\n", "milestone", "this run", "p50", "p90",
+            "p99", "runs");
+
+    for (int i = 0; i < milestoneCount; i ++) {
+        Milestone_t *m = &milestones[i];
+
+        if (m->hit >= 0) {
+            MilestoneRecord(m, m->hit);
+            AbRecord(1 + i, m->hit);
+            if (fp) fprintf(fp, "%lld %s\n", (long long)m->hit, m->pattern);
+        }
+
+        fprintf(stderr, "  %-32.32s ", m->pattern);
+        if (m->hit >= 0) fprintf(stderr, "%10.3f ", m->hit / 1000.0);
+        else fprintf(stderr, "%10s ", "missed");
+
+        if (m->count) MilestoneHistogram(m);
+        else fprintf(stderr, "\n");
+    }
+
+    if (fp) fclose(fp);
+    AbReport();
+}
+
+
+//
+// -- Scan console output for the milestones, carrying partial matches over from the last read
+//    ----------------------------------------------------------------------------------------
+void MilestoneScan(const char *buf, ssize_t len)
+{
+    if (!milestonesArmed) return;
+
+    const int64_t now = NowUsec() - sessionStart;
+    bool all = true;
+
+    for (int i = 0; i < milestoneCount; i ++) {
+        Milestone_t *m = &milestones[i];
+
+        for (ssize_t j = 0; j < len && m->hit < 0; j ++) {
+            while (m->pos && buf[j] != m->pattern[m->pos]) m->pos = m->fail[m->pos - 1];
+            if (buf[j] == m->pattern[m->pos]) m->pos ++;
+            if (m->pos == m->len) m->hit = now;
+        }
+
+        if (m->hit < 0) all = false;
+    }
+
+    if (all) MilestoneFinish();
+}
+
+
+//
+// -- Build the KMP failure tables and load the history of earlier runs (lines of "<usec> <pattern>")
+//    -----------------------------------------------------------------------------------------------
+void MilestoneInit(void)
+{
+    for (int i = 0; i < milestoneCount; i ++) {
+        Milestone_t *m = &milestones[i];
+
+        m->len = strlen(m->pattern);
+        m->fail = (int *)malloc(m->len * sizeof(int));
+        if (!m->fail) {
+            perror("milestone");
+            exit(EXIT_FAILURE);
+        }
+
+        m->fail[0] = 0;
+        for (int k = 0, j = 1; j < m->len; j ++) {
+            while (k && m->pattern[j] != m->pattern[k]) k = m->fail[k - 1];
+            if (m->pattern[j] == m->pattern[k]) k ++;
+            m->fail[j] = k;
+        }
+
+        m->hit = -1;
+    }
+
+    // -- a run in progress at exit (Ctrl-C) still counts
+    if (milestoneCount) atexit(MilestoneFinish);
+
+    if (!historyName || !milestoneCount) return;
+
+    FILE *fp = fopen(historyName, "r");
+    if (!fp) return;                        // -- no history yet
+
+    char line[1024];
+    while (fgets(line, sizeof(line), fp)) {
+        char *pat = NULL;
+        long long usec = strtoll(line, &pat, 10);
+        if (*pat++ != ' ') continue;
+        pat[strcspn(pat, "\n")] = 0;
+
+        for (int i = 0; i < milestoneCount; i ++) {
+            if (strcmp(pat, milestones[i].pattern) == 0) MilestoneRecord(&milestones[i], usec);
+        }
+    }
+
+    fclose(fp);
+}
+
+
+//
+// -- Compare 2 symbols by address for qsort()
+//    ----------------------------------------
+static int CompareSymbol(const void *a, const void *b)
+{
+    uint32_t x = ((const Symbol_t *)a)->addr;
+    uint32_t y = ((const Symbol_t *)b)->addr;
+    return (x > y) - (x < y);
+}
+
+
+//
+// -- Build the sorted symbol index from the .symtab of the kernel (the functions and objects; nothing else has
+//    an address worth reporting)
+//    --------------------------------------------------------------------------------------------------------
+void SymLoad(int fd, const Elf32_Ehdr_t *ehdr)
+{
+    Elf32_Shdr_t *shdr = NULL;
+    Elf32_Sym_t *syms = NULL;
+    int nsyms = 0;
+
+    free(symbols);
+    free(symNames);
+    free(profCounts);
+    symbols = NULL;
+    symNames = NULL;
+    profCounts = NULL;
+    symCount = 0;
+
+    if (ehdr->e_shoff == 0 || ehdr->e_shnum == 0 || ehdr->e_shentsize != sizeof(Elf32_Shdr_t)) goto none;
+
+    shdr = (Elf32_Shdr_t *)malloc(ehdr->e_shnum * sizeof(Elf32_Shdr_t));
+    if (!shdr) goto none;
+    if (pread(fd, shdr, ehdr->e_shnum * sizeof(Elf32_Shdr_t), ehdr->e_shoff)
+            != (ssize_t)(ehdr->e_shnum * sizeof(Elf32_Shdr_t))) goto none;
+
+    for (int i = 0; i < ehdr->e_shnum; i ++) {
+        if (shdr[i].sh_type != SHT_SYMTAB || shdr[i].sh_link >= ehdr->e_shnum) continue;
+
+        const Elf32_Shdr_t *str = &shdr[shdr[i].sh_link];
+        nsyms = shdr[i].sh_size / sizeof(Elf32_Sym_t);
+        syms = (Elf32_Sym_t *)malloc(shdr[i].sh_size);
+        symNames = (char *)malloc(str->sh_size + 1);
+        symbols = (Symbol_t *)malloc((nsyms + 1) * sizeof(Symbol_t));
+
+        if (!syms || !symNames || !symbols
+                || pread(fd, syms, nsyms * sizeof(Elf32_Sym_t), shdr[i].sh_offset)
+                        != (ssize_t)(nsyms * sizeof(Elf32_Sym_t))
+                || pread(fd, symNames, str->sh_size, str->sh_offset) != (ssize_t)str->sh_size) {
+            goto none;
+        }
+
+        symNames[str->sh_size] = 0;
+
+        for (int s = 0; s < nsyms; s ++) {
+            const int type = ELF32_ST_TYPE(syms[s].st_info);
+
+            if ((type != STT_FUNC && type != STT_OBJECT) || syms[s].st_shndx == 0) continue;
+            if (syms[s].st_name >= str->sh_size) continue;
+
+            symbols[symCount].addr = syms[s].st_value & (type == STT_FUNC ? ~1 : ~0);   // -- the thumb bit
+            symbols[symCount].size = syms[s].st_size;
+            symbols[symCount].name = symNames + syms[s].st_name;
+            symCount ++;
+        }
+
+        break;
+    }
+
+    free(shdr);
+    free(syms);
+    shdr = NULL;
+    syms = NULL;
+
+    if (!symCount) goto none;
+
+    qsort(symbols, symCount, sizeof(Symbol_t), CompareSymbol);
+    return;
+
+none:
+    free(shdr);
+    free(syms);
+    free(symbols);
+    free(symNames);
+    symbols = NULL;
+    symNames = NULL;
+    symCount = 0;
+}
+
+
+//
+// -- Find the symbol for an address: the last one at or below it, if the address is inside it; returns symCount
+//    when there is none
+//    ----------------------------------------------------------------------------------------------------------
+int SymFind(uint32_t addr)
+{
+    int lo = 0, hi = symCount;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (symbols[mid].addr <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+
+    if (lo == 0) return symCount;
+
+    const Symbol_t *sym = &symbols[lo - 1];
+
+    // -- a symbol with no size runs to the next one
+    return (!sym->size || addr - sym->addr < sym->size) ? lo - 1 : symCount;
+}
+
+
+//
+// -- Add a stack (root first, separated with ';') to the folded stacks
+//    -----------------------------------------------------------------
+static void FoldAdd(const char *stack)
+{
+    uint32_t hash = 2166136261u;            // -- FNV-1a
+    for (const char *c = stack; *c; c ++) hash = (hash ^ (uint8_t)*c) * 16777619u;
+
+    if (2 * (foldCount + 1) > foldCap) {
+        int oldCap = foldCap;
+        FoldEntry_t *old = foldTable;
+
+        foldCap = foldCap ? foldCap * 2 : 256;
+        foldTable = (FoldEntry_t *)calloc(foldCap, sizeof(FoldEntry_t));
+        if (!foldTable) {
+            perror("folded stacks");
+            exit(EXIT_FAILURE);
+        }
+
+        for (int i = 0; i < oldCap; i ++) {
+            if (!old[i].stack) continue;
+
+            uint32_t j = old[i].hash & (foldCap - 1);
+            while (foldTable[j].stack) j = (j + 1) & (foldCap - 1);
+            foldTable[j] = old[i];
+        }
+
+        free(old);
+    }
+
+    uint32_t j = hash & (foldCap - 1);
+    while (foldTable[j].stack) {
+        if (foldTable[j].hash == hash && strcmp(foldTable[j].stack, stack) == 0) {
+            foldTable[j].count ++;
+            return;
+        }
+
+        j = (j + 1) & (foldCap - 1);
+    }
+
+    foldTable[j].stack = strdup(stack);
+    if (!foldTable[j].stack) {
+        perror("folded stacks");
+        exit(EXIT_FAILURE);
+    }
+
+    foldTable[j].hash = hash;
+    foldTable[j].count = 1;
+    foldCount ++;
+}
+
+
+//
+// -- Compare 2 flat profile entries (symbol indexes) by their sample counts, most first, for qsort()
+//    -----------------------------------------------------------------------------------------------
+static int CompareProfile(const void *a, const void *b)
+{
+    uint32_t x = profCounts[*(const int *)a];
+    uint32_t y = profCounts[*(const int *)b];
+    return (x < y) - (x > y);
+}
+
+
+//
+// -- Print the top of the flat profile: the samples that landed in each function
+//    ---------------------------------------------------------------------------
+void ProfileReport(void)
+{
+    int *order = (int *)malloc((symCount + 1) * sizeof(int));
+    if (!order) return;
+
+    for (int i = 0; i <= symCount; i ++) order[i] = i;
+    qsort(order, symCount + 1, sizeof(int), CompareProfile);
+
+    fprintf(stderr, "\nProfile: %u samples; top %d by self samples:\n", profSamples, PROF_TOP);
+    for (int i = 0; i < PROF_TOP && i <= symCount && profCounts[order[i]]; i ++) {
+        fprintf(stderr, "  %6.2f%% %8u  %s\n", 100.0 * profCounts[order[i]] / profSamples, profCounts[order[i]],
+                order[i] == symCount ? "[unknown]" : symbols[order[i]].name);
+    }
+
+    free(order);
+    profReported = NowUsec();
+}
+
+
+//
+// -- A record of PC samples: each one is a frame count and the frames, leaf first
+//    ----------------------------------------------------------------------------
+void ProfileSamples(const uint8_t *payload, uint32_t len)
+{
+    // -- one more counter for the samples outside every symbol
+    if (!profCounts) {
+        profCounts = (uint32_t *)calloc(symCount + 1, sizeof(uint32_t));
+        if (!profCounts) {
+            perror("profile");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    while (len) {
+        uint32_t depth;
+        uint32_t pc[PROF_MAX_DEPTH];
+        char stack[PROF_MAX_DEPTH * 64];
+        int n = 0;
+
+        if (len >= 4) memcpy(&depth, payload, 4);
+        if (len < 4 || depth == 0 || depth > PROF_MAX_DEPTH || len - 4 < depth * 4) {
+            fprintf(stderr, "\nDiscarding a malformed profile record\n");
+            return;
+        }
+
+        memcpy(pc, payload + 4, depth * 4);
+        payload += 4 + depth * 4;
+        len -= 4 + depth * 4;
+
+        const int leaf = SymFind(pc[0]);
+        profCounts[leaf] ++;
+        profSamples ++;
+
+        // -- the folded stack is root first
+        for (int f = depth - 1; f >= 0 && n < (int)sizeof(stack) - 64; f --) {
+            const int s = SymFind(pc[f]);
+
+            if (s == symCount) n += snprintf(stack + n, sizeof(stack) - n, "%s0x%08x", n ? ";" : "", pc[f]);
+            else n += snprintf(stack + n, sizeof(stack) - n, "%s%.60s", n ? ";" : "", symbols[s].name);
+        }
+
+        FoldAdd(stack);
+    }
+
+    if (NowUsec() - profReported >= PROF_REPORT_USEC) ProfileReport();
+}
+
+
+//
+// -- The session is over: report the whole profile, write the folded stacks, and start over
+//    --------------------------------------------------------------------------------------
+void ProfileFinish(void)
+{
+    if (!profSamples) return;
+
+    ProfileReport();
+
+    FILE *fp = foldedName ? fopen(foldedName, "w") : NULL;
+    if (foldedName && !fp) perror(foldedName);
+
+    for (int i = 0; i < foldCap; i ++) {
+        if (!foldTable[i].stack) continue;
+
+        if (fp) fprintf(fp, "%s %u\n", foldTable[i].stack, foldTable[i].count);
+        free(foldTable[i].stack);
+        foldTable[i].stack = NULL;
+    }
+
+    if (fp) {
+        fclose(fp);
+        fprintf(stderr, "Profile: %d distinct stacks written to %s\n", foldCount, foldedName);
+    }
+
+    foldCount = 0;
+    profSamples = 0;
+    memset(profCounts, 0, (symCount + 1) * sizeof(uint32_t));
+}
+
+
+//
+// -- Keep a kernel ELF (already checked) for the log strings; the fd is ours to close
+//    --------------------------------------------------------------------------------
+void LogElfLoad(int fd)
+{
+    Elf32_Ehdr_t ehdr;
+
+    if (logElfFd != -1) close(logElfFd);
+    logElfFd = -1;
+    logPhdrCount = 0;
+
+    if (pread(fd, &ehdr, sizeof(ehdr), 0) != sizeof(ehdr) || memcmp(ehdr.e_ident, "\x7f" "ELF", 4) != 0
+            || ehdr.e_phnum > LOG_MAX_PHDRS
+            || pread(fd, logPhdr, ehdr.e_phnum * sizeof(Elf32_Phdr_t), ehdr.e_phoff)
+                    != (ssize_t)(ehdr.e_phnum * sizeof(Elf32_Phdr_t))) {
+        fprintf(stderr, "The log strings cannot be read from this kernel\n");
+        close(fd);
+        return;
+    }
+
+    logElfFd = fd;
+    logPhdrCount = ehdr.e_phnum;
+
+    SymLoad(fd, &ehdr);
+    if (!symCount) fprintf(stderr, "The kernel has no symbols; profile samples will not be symbolized\n");
+}
+
+
+//
+// -- Read bytes at a kernel virtual address from the kernel ELF; returns the bytes read
+//    ----------------------------------------------------------------------------------
+ssize_t ElfRead(uint32_t addr, void *buf, size_t len)
+{
+    for (int i = 0; i < logPhdrCount; i ++) {
+        const Elf32_Phdr_t *ph = &logPhdr[i];
+
+        if (ph->p_type != PT_LOAD) continue;
+        if (addr < ph->p_vaddr || addr - ph->p_vaddr >= ph->p_filesz) continue;
+
+        uint32_t avail = ph->p_filesz - (addr - ph->p_vaddr);
+        ssize_t res = pread(logElfFd, buf, len < avail ? len : avail, ph->p_offset + addr - ph->p_vaddr);
+        return res < 0 ? 0 : res;
+    }
+
+    return 0;
+}
+
+
+//
+// -- Read a NUL-terminated string from the kernel ELF
+//    ------------------------------------------------
+static bool ElfString(uint32_t addr, char *buf, size_t max)
+{
+    ssize_t len = ElfRead(addr, buf, max - 1);
+    if (len <= 0) return false;
+
+    buf[len] = 0;
+    return true;
+}
+
+
+//
+// -- Send console text to stdout, and on to the milestones
+//    -----------------------------------------------------
+void ConsoleText(const char *text, size_t len)
+{
+    MilestoneScan(text, len);
+
+    while (len) {
+        ssize_t res = write(STDOUT_FILENO, text, len);
+        if (res == -1) {
+            perror("write() to stdout");
+            exit(EXIT_FAILURE);
+        }
+
+        text += res;
+        len -= res;
+    }
+}
+
+
+//
+// -- Expand a binary log record: a printf format (by its address in the kernel) with its 32-bit arguments
+//    ----------------------------------------------------------------------------------------------------
+static int LogFormat(char *out, int max, uint32_t fmtAddr, const uint32_t *args, int argc)
+{
+    char fmtBuf[LOG_STRING_MAX];
+    char str[LOG_STRING_MAX];
+    const char *fmt = fmtBuf;
+    int o = 0;
+    int a = 0;
+
+    if (!ElfString(fmtAddr, fmtBuf, sizeof(fmtBuf))) {
+        // -- not in this kernel: show what we got
+        o = snprintf(out, max, "[log %08x", fmtAddr);
+        for (int i = 0; i < argc && o < max; i ++) o += snprintf(out + o, max - o, " %08x", args[i]);
+        if (o < max) o += snprintf(out + o, max - o, "]\n");
+        return o < max ? o : max - 1;
+    }
+
+    while (*fmt && o < max - 1) {
+        if (*fmt != '%') {
+            out[o ++] = *fmt ++;
+            continue;
+        }
+
+        // -- copy the flags, width and precision; the length is ours to decide
+        char spec[24];
+        int n = 0;
+        int longs = 0;
+
+        spec[n ++] = *fmt ++;
+        while (*fmt && strchr("-+ #0123456789.", *fmt) && n < 16) spec[n ++] = *fmt ++;
+        while (*fmt == 'l' || *fmt == 'h' || *fmt == 'z') if (*fmt ++ == 'l') longs ++;
+
+        char conv = *fmt;
+        if (conv) fmt ++;
+
+        // -- only the conversions that print a value take an argument (and 2 for a long long)
+        uint64_t v = 0;
+        if (conv && strchr("diuxXocps", conv)) {
+            v = (a < argc ? args[a ++] : 0);
+            if (longs >= 2 && strchr("diuxXo", conv)) v |= (uint64_t)(a < argc ? args[a ++] : 0) << 32;
+        }
+
+        switch (conv) {
+        case 'd':
+        case 'i':
+            spec[n ++] = 'l';
+            spec[n ++] = 'l';
+            spec[n ++] = conv;
+            spec[n] = 0;
+            o += snprintf(out + o, max - o, spec, longs >= 2 ? (long long)(int64_t)v : (long long)(int32_t)v);
+            break;
+
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+            spec[n ++] = 'l';
+            spec[n ++] = 'l';
+            spec[n ++] = conv;
+            spec[n] = 0;
+            o += snprintf(out + o, max - o, spec, (unsigned long long)v);
+            break;
+
+        case 'c':
+            spec[n ++] = 'c';
+            spec[n] = 0;
+            o += snprintf(out + o, max - o, spec, (int)(v & 0xff));
+            break;
+
+        case 'p':
+            o += snprintf(out + o, max - o, "0x%08x", (uint32_t)v);
+            break;
+
+        case 's':
+            spec[n ++] = 's';
+            spec[n] = 0;
+            if (ElfString(v, str, sizeof(str))) o += snprintf(out + o, max - o, spec, str);
+            else o += snprintf(out + o, max - o, "(%08x)", (uint32_t)v);
+            break;
+
+        case '%':
+            out[o ++] = '%';
+            break;
+
+        default:
+            o += snprintf(out + o, max - o, "%.*s%c", n, spec, conv);
+            break;
+        }
+
+        if (o >= max) o = max - 1;
+    }
+
+    return o;
+}
+
+
+//
+// -- Write a string to a JSON file, escaped
+//    --------------------------------------
+static void JsonString(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for ( ; *s; s ++) {
+        if (*s == '"' || *s == '\\') fprintf(fp, "\\%c", *s);
+        else if ((uint8_t)*s < ' ') fprintf(fp, "\\u%04x", (uint8_t)*s);
+        else fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+
+//
+// -- Convert an uploaded file of binary trace events to Chrome trace JSON next to it
+//    -------------------------------------------------------------------------------
+void UploadConvert(const char *path)
+{
+    EventHdr_t hdr;
+    Event_t ev;
+    char json[PATH_MAX + 8];
+    char name[LOG_STRING_MAX];
+
+    FILE *in = fopen(path, "rb");
+    if (!in) {
+        perror(path);
+        return;
+    }
+
+    if (fread(&hdr, sizeof(hdr), 1, in) != 1 || memcmp(hdr.magic, EVENT_MAGIC, 4) != 0
+            || hdr.version != EVENT_VERSION || hdr.tickHz == 0) {
+        fprintf(stderr, "Upload: %s is not a trace event file\n", path);
+        fclose(in);
+        return;
+    }
+
+    snprintf(json, sizeof(json), "%s.json", path);
+    FILE *out = fopen(json, "w");
+    if (!out) {
+        perror(json);
+        fclose(in);
+        return;
+    }
+
+    uint64_t ticks = 0;                     // -- the 32-bit tick count is extended as it wraps
+    uint32_t last = 0;
+    int count = 0;
+
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    while (fread(&ev, sizeof(ev), 1, in) == 1) {
+        if (count) ticks += (uint32_t)(ev.time - last);
+        last = ev.time;
+
+        if (!ElfString(ev.name, name, sizeof(name))) snprintf(name, sizeof(name), "0x%08x", ev.name);
+
+        fprintf(out, "%s\n{\"name\":", count ++ ? "," : "");
+        JsonString(out, name);
+        fprintf(out, ",\"ph\":\"%c\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f", ev.type, ev.cpu, ev.tid,
+                ticks * 1e6 / hdr.tickHz);
+
+        switch (ev.type) {
+        case EVENT_COUNTER:
+            fprintf(out, ",\"args\":{\"value\":%u}}", ev.arg);
+            break;
+
+        case EVENT_INSTANT:
+            fprintf(out, ",\"s\":\"t\",\"args\":{\"arg\":%u}}", ev.arg);
+            break;
+
+        default:
+            fprintf(out, ",\"args\":{\"arg\":%u}}", ev.arg);
+            break;
+        }
+    }
+
+    fprintf(out, "\n]}\n");
+    fclose(out);
+    fclose(in);
+    fprintf(stderr, "Upload: %d trace events converted to %s\n", count, json);
+}
+
+
+//
+// -- Finish an upload: check the length and the CRC, and give the file its real name
+//    -------------------------------------------------------------------------------
+static void UploadEnd(Upload_t *up)
+{
+    uint8_t buf[4096];
+    uint32_t crc = 0;
+    ssize_t len;
+    off_t pos = 0;
+    char path[PATH_MAX];
+
+    while ((len = pread(up->fd, buf, sizeof(buf), pos)) > 0) {
+        crc = Crc32(crc, buf, len);
+        pos += len;
+    }
+
+    close(up->fd);
+    up->fd = -1;
+
+    if (up->received != up->length || pos != up->length || crc != up->crc) {
+        fprintf(stderr, "\nUpload: %s is bad (%u of %u bytes, crc32 %08x, expected %08x); kept as %s\n", up->name,
+                up->received, up->length, crc, up->crc, up->part);
+        return;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", uploadDir, up->name);
+    if (rename(up->part, path) == -1) {
+        perror(path);
+        return;
+    }
+
+    fprintf(stderr, "\nUpload: %s (%u bytes in %u on the wire, %.2f sec)\n", path, up->length, up->wire,
+            (NowUsec() - up->start) / 1e6);
+
+    if (up->flags & UPLOAD_EVENTS) UploadConvert(path);
+}
+
+
+//
+// -- Start an upload: the file is written as <name>.part in the session directory until it is complete
+//    -------------------------------------------------------------------------------------------------
+static void UploadBegin(Upload_t *up, const UploadBegin_t *begin, const char *name, int nameLen)
+{
+    // -- the session directory is only created once something is uploaded
+    if (!uploadDir[0]) {
+        char stamp[32];
+        time_t now = time(NULL);
+
+        strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&now));
+        if (mkdir(uploadRoot, 0777) == -1 && errno != EEXIST) perror(uploadRoot);
+
+        // -- 2 boots in the same second still get their own directories
+        for (int n = 1; ; n ++) {
+            if (n == 1) snprintf(uploadDir, sizeof(uploadDir), "%s/%s", uploadRoot, stamp);
+            else snprintf(uploadDir, sizeof(uploadDir), "%s/%s-%d", uploadRoot, stamp, n);
+
+            if (mkdir(uploadDir, 0777) == 0) break;
+            if (errno == EEXIST) continue;
+
+            perror(uploadDir);
+            uploadDir[0] = 0;
+            return;
+        }
+    }
+
+    if (up->fd != -1) {
+        fprintf(stderr, "\nUpload: %s was never finished; kept as %s\n", up->name, up->part);
+        close(up->fd);
+    }
+
+    // -- the name is only ever a file name in the session directory
+    char file[sizeof(up->name)];
+
+    if (nameLen > (int)sizeof(file) - 1) nameLen = sizeof(file) - 1;
+    for (int i = 0; i < nameLen; i ++) {
+        file[i] = (name[i] == '/' || name[i] == 0 || (uint8_t)name[i] < ' ') ? '_' : name[i];
+    }
+    file[nameLen] = 0;
+    if (nameLen == 0 || strcmp(file, ".") == 0 || strcmp(file, "..") == 0) {
+        snprintf(file, sizeof(file), "upload-%d", begin->id);
+    }
+
+    strcpy(up->name, file);
+    snprintf(up->part, sizeof(up->part), "%s/%s.part", uploadDir, file);
+    up->fd = open(up->part, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (up->fd == -1) {
+        perror(up->part);
+        return;
+    }
+
+    up->length = begin->length;
+    up->crc = begin->crc;
+    up->flags = begin->flags;
+    up->received = 0;
+    up->wire = 0;
+    up->start = NowUsec();
+}
+
+
+//
+// -- A record on the upload channel: the start of a file, a chunk of it (maybe compressed), or its end
+//    -------------------------------------------------------------------------------------------------
+void UploadRecord(const uint8_t *payload, uint32_t len)
+{
+    static uint8_t chunk[UPLOAD_CHUNK_MAX];
+    UploadData_t data;
+
+    if (!uploadRoot) {
+        if (!uploadWarned) fprintf(stderr, "\nUpload: the kernel is uploading files; use -u <dir> to keep them\n");
+        uploadWarned = true;
+        return;
+    }
+
+    if (len < 2 || payload[1] >= UPLOAD_MAX) {
+        fprintf(stderr, "\nDiscarding a malformed upload record\n");
+        return;
+    }
+
+    Upload_t *up = &uploads[payload[1]];
+
+    switch (payload[0]) {
+    case UPLOAD_BEGIN: {
+        UploadBegin_t begin;
+
+        if (len < sizeof(begin)) break;
+        memcpy(&begin, payload, sizeof(begin));
+        UploadBegin(up, &begin, (const char *)payload + sizeof(begin), len - sizeof(begin));
+        return;
+    }
+
+    case UPLOAD_DATA:
+    case UPLOAD_LZ: {
+        if (len < sizeof(data) || up->fd == -1) break;
+        memcpy(&data, payload, sizeof(data));
+
+        const uint8_t *bytes = payload + sizeof(data);
+        int n = len - sizeof(data);
+
+        if (data.op == UPLOAD_LZ) {
+            n = LzDecompress(bytes, n, chunk, sizeof(chunk));
+            bytes = chunk;
+        }
+
+        if (n < 0 || data.offset + (uint64_t)n > up->length) break;
+
+        if (pwrite(up->fd, bytes, n, data.offset) != n) {
+            perror(up->part);
+            close(up->fd);
+            up->fd = -1;
+            return;
+        }
+
+        up->received += n;
+        up->wire += len + 4;
+        return;
+    }
+
+    case UPLOAD_END:
+        if (up->fd == -1) break;
+        UploadEnd(up);
+        return;
+    }
+
+    fprintf(stderr, "\nDiscarding a malformed upload record\n");
+}
+
+
+//
+// -- The session is over: the uploads that never finished are left as they are, and the next session gets a new
+//    directory
+//    ----------------------------------------------------------------------------------------------------------
+void UploadFinish(void)
+{
+    for (int i = 0; i < UPLOAD_MAX; i ++) {
+        if (uploads[i].fd == -1) continue;
+
+        fprintf(stderr, "\nUpload: %s was never finished; kept as %s\n", uploads[i].name, uploads[i].part);
+        close(uploads[i].fd);
+        uploads[i].fd = -1;
+    }
+
+    uploadDir[0] = 0;
+}
+
+
+//
+// -- Queue bytes for the rpi; DoTty() writes them as the tty has room, so a big reply never holds up the console
+//    ------------------------------------------------------------------------------------------------------------
+void ConsoleSend(const void *data, size_t len)
+{
+    if (conTxLen + len > conTxCap) {
+        while (conTxLen + len > conTxCap) conTxCap = conTxCap ? conTxCap * 2 : 65536;
+
+        conTx = (uint8_t *)realloc(conTx, conTxCap);
+        if (!conTx) {
+            perror("console output");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    memcpy(conTx + conTxLen, data, len);
+    conTxLen += len;
+}
+
+
+//
+// -- Write as much of the queue to the rpi as the tty will take; returns false on an error
+//    -------------------------------------------------------------------------------------
+bool ConsoleTxFlush(void)
+{
+    while (conTxSent < conTxLen) {
+        ssize_t len = DevWrite(conTx + conTxSent, conTxLen - conTxSent);
+
+        if (len == -1) {
+            if (errno == EAGAIN) return true;
+            perror("write() to tty");
+            return false;
+        }
+
+        conTxSent += len;
+    }
+
+    conTxSent = conTxLen = 0;
+    return true;
+}
+
+
+//
+// -- The hash bucket for a block of a file
+//    -------------------------------------
+static inline int CacheHash(const OpenFile_t *f, uint32_t block)
+{
+    return (uint32_t)((f->ino * 31 + f->mtime) * 2654435761u + block * 40503u) & (CACHE_BUCKETS - 1);
+}
+
+
+//
+// -- Find a block in the cache; returns NULL on a miss
+//    -------------------------------------------------
+static CacheBlock_t *CacheFind(const OpenFile_t *f, uint32_t block)
+{
+    if (!cache) return NULL;
+
+    const int h = CacheHash(f, block);
+
+    for (int i = cacheBucket[h]; i != -1; i = cache[i].next) {
+        CacheBlock_t *c = &cache[i];
+        if (c->ino == f->ino && c->dev == f->dev && c->mtime == f->mtime && c->block == block) {
+            c->used = ++ cacheClock;
+            return c;
+        }
+    }
+
+    return NULL;
+}
+
+
+//
+// -- Read a block of a file into the cache (taking the least recently used slot), or find it there already
+//    -----------------------------------------------------------------------------------------------------
+static CacheBlock_t *CacheLoad(const OpenFile_t *f, uint32_t block, bool *hit)
+{
+    CacheBlock_t *c = CacheFind(f, block);
+
+    if (hit) *hit = (c != NULL);
+    if (c) return c;
+
+    // -- the cache is allocated when it is first needed
+    if (!cache) {
+        cache = (CacheBlock_t *)calloc(CACHE_BLOCKS, sizeof(CacheBlock_t));
+        if (!cache) {
+            perror("file cache");
+            exit(EXIT_FAILURE);
+        }
+
+        for (int i = 0; i < CACHE_BUCKETS; i ++) cacheBucket[i] = -1;
+        for (int i = 0; i < CACHE_BLOCKS; i ++) cache[i].bucket = -1;
+    }
+
+    int victim = 0;
+    for (int i = 1; i < CACHE_BLOCKS && cache[victim].used; i ++) if (cache[i].used < cache[victim].used) victim = i;
+    c = &cache[victim];
+
+    // -- unlink it from its old chain
+    if (c->bucket != -1) {
+        int *link = &cacheBucket[c->bucket];
+        while (*link != victim) link = &cache[*link].next;
+        *link = c->next;
+    }
+
+    ssize_t len = pread(f->fd, c->data, FILE_BLOCK, (off_t)block * FILE_BLOCK);
+    if (len < 0) {
+        c->bucket = -1;
+        c->used = 0;
+        return NULL;
+    }
+
+    c->ino = f->ino;
+    c->dev = f->dev;
+    c->mtime = f->mtime;
+    c->block = block;
+    c->len = (uint32_t)len;
+    c->used = ++ cacheClock;
+    c->bucket = CacheHash(f, block);
+    c->next = cacheBucket[c->bucket];
+    cacheBucket[c->bucket] = victim;
+
+    return c;
 }
 
 
 //
-// -- On normal exit, use this function to clean up
-//    ---------------------------------------------
-void Cleanup(void)
+// -- Resolve a path from the rpi against the file service directory; nothing outside it can be named
+//    -----------------------------------------------------------------------------------------------
+static bool FilePath(char *out, size_t max, const uint8_t *path, uint32_t len)
 {
-    if (fdDev != -1) close(fdDev);
-    fdDev = -1;
+    char name[FILE_PATH_MAX];
 
-    // -- restore settings for STDIN_FILENO
-    if (isatty(STDIN_FILENO)) tcsetattr(STDIN_FILENO, TCSANOW, &oldTio);
+    if (len == 0 || len >= sizeof(name)) return false;
+    memcpy(name, path, len);
+    name[len] = 0;
+    if (strlen(name) != len) return false;
+
+    for (char *c = strtok(name, "/"); c; c = strtok(NULL, "/")) {
+        if (strcmp(c, "..") == 0) return false;
+    }
+
+    memcpy(name, path, len);                // -- strtok() took it apart
+    name[len] = 0;
+
+    return snprintf(out, max, "%s/%s", fileRoot, name) < (int)max;
 }
 
 
 //
-// -- Print the usage information and then exit
-//    -----------------------------------------
-void PrintUsage(const char * const pgm)
+// -- Queue a reply to the rpi: DLE 'F' <length> <op> <tag> <status> <data>
+//    ---------------------------------------------------------------------
+static void FileReply(const FileReq_t *req, int32_t status, const void *data, uint32_t len)
 {
-    printf("\nUsage:\n");
-    printf("  %s <dev> <cfg-file>\n", pgm);
-    exit(EXIT_FAILURE);
+    FileReply_t reply = { .op = req->op, .tag = req->tag, .status = status };
+    uint8_t hdr[4] = { CON_DLE, CHAN_FILE, 0, 0 };
+    uint16_t total = sizeof(reply) + len;
+
+    memcpy(&hdr[2], &total, 2);
+    ConsoleSend(hdr, sizeof(hdr));
+    ConsoleSend(&reply, sizeof(reply));
+    if (len) ConsoleSend(data, len);
+
+    fileStats.replyBytes += sizeof(hdr) + total;
 }
 
 
 //
-// -- Make sure the command line is well formatted
-//    --------------------------------------------
-void ParseCommandLine(int argc, const char * const argv[])
+// -- Read from an open file through the cache, and read ahead when the reads are sequential
+//    --------------------------------------------------------------------------------------
+static void FileRead(const FileReadReq_t *req)
 {
-    if (argc != 3) PrintUsage(argv[0]);
-    dev = argv[1];
-    cfg = argv[2];
+    static uint8_t data[FILE_READ_MAX];
+    OpenFile_t *f = (req->handle < FILE_MAX_OPEN ? &openFiles[req->handle] : NULL);
+
+    if (!f || f->fd == -1) {
+        FileReply((const FileReq_t *)req, -EBADF, NULL, 0);
+        return;
+    }
+
+    uint32_t len = (req->length > FILE_READ_MAX ? FILE_READ_MAX : req->length);
+    if (req->offset >= f->size) len = 0;
+    else if (len > f->size - req->offset) len = f->size - req->offset;
+
+    uint32_t done = 0;
+    while (done < len) {
+        const uint32_t pos = req->offset + done;
+        bool hit;
+        CacheBlock_t *c = CacheLoad(f, pos / FILE_BLOCK, &hit);
+
+        if (!c) {
+            FileReply((const FileReq_t *)req, -EIO, NULL, 0);
+            return;
+        }
+
+        if (hit) fileStats.hits ++;
+        else fileStats.misses ++;
+
+        if (c->len <= pos % FILE_BLOCK) break;          // -- the file is shorter than it was
+        uint32_t n = c->len - pos % FILE_BLOCK;
+        if (n > len - done) n = len - done;
+
+        memcpy(&data[done], &c->data[pos % FILE_BLOCK], n);
+        done += n;
+    }
+
+    FileReply((const FileReq_t *)req, done, data, done);
+    fileStats.readBytes += done;
+
+    // -- a sequential reader gets the next blocks loaded before it asks for them
+    if (req->offset == f->next) {
+        if (f->ahead < FILE_READ_AHEAD) f->ahead = (f->ahead ? f->ahead * 2 : 1);
+        if (f->ahead > FILE_READ_AHEAD) f->ahead = FILE_READ_AHEAD;
+    } else {
+        f->ahead = 0;
+    }
+
+    f->next = req->offset + done;
+    for (uint32_t b = 1; b <= f->ahead; b ++) {
+        uint32_t block = (f->next + FILE_BLOCK - 1) / FILE_BLOCK + b - 1;
+        if ((uint64_t)block * FILE_BLOCK >= f->size) break;
+        if (!CacheFind(f, block) && CacheLoad(f, block, NULL)) fileStats.readAhead ++;
+    }
 }
 
 
 //
-// -- Initialize the MBI structure
-//    ----------------------------
-void InitMbi(void)
+// -- A request from the kernel for the file service: open, read, stat, or close
+//    --------------------------------------------------------------------------
+void FileRequest(const uint8_t *payload, uint32_t len)
+{
+    char path[PATH_MAX];
+    struct stat st;
+    FileReq_t req;
+
+    if (len < sizeof(req)) {
+        fprintf(stderr, "\nDiscarding a malformed file request\n");
+        return;
+    }
+
+    memcpy(&req, payload, sizeof(req));
+    fileStats.requests ++;
+
+    // -- without -f there are no replies: typed DLEs are not doubled, so the kernel could not pick them out
+    if (!fileRoot) {
+        if (!fileWarned) fprintf(stderr, "\nFile service: the kernel is asking for files; use -f <dir> to serve them\n");
+        fileWarned = true;
+        return;
+    }
+
+    switch (req.op) {
+    case FILE_OPEN:
+    case FILE_STAT: {
+        if (!FilePath(path, sizeof(path), payload + sizeof(req), len - sizeof(req))) {
+            FileReply(&req, -EINVAL, NULL, 0);
+            return;
+        }
+
+        if (req.op == FILE_STAT) {
+            if (stat(path, &st) == -1) {
+                FileReply(&req, -errno, NULL, 0);
+                return;
+            }
+
+            FileStat_t fs = { .size = st.st_size, .mtime = st.st_mtime, .mode = st.st_mode };
+            FileReply(&req, 0, &fs, sizeof(fs));
+            return;
+        }
+
+        int h = 0;
+        while (h < FILE_MAX_OPEN && openFiles[h].fd != -1) h ++;
+        if (h == FILE_MAX_OPEN) {
+            FileReply(&req, -EMFILE, NULL, 0);
+            return;
+        }
+
+        OpenFile_t *f = &openFiles[h];
+        int err = 0;
+
+        f->fd = open(path, O_RDONLY);
+        if (f->fd == -1 || fstat(f->fd, &st) == -1) err = errno;
+        else if (!S_ISREG(st.st_mode)) err = EISDIR;
+
+        if (err) {
+            if (f->fd != -1) close(f->fd);
+            f->fd = -1;
+            FileReply(&req, -err, NULL, 0);
+            return;
+        }
+
+        f->dev = st.st_dev;
+        f->ino = st.st_ino;
+        f->mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+        f->size = st.st_size;
+        f->next = 0;
+        f->ahead = 0;
+
+        uint32_t size = f->size;
+        FileReply(&req, h, &size, sizeof(size));
+        return;
+    }
+
+    case FILE_READ: {
+        FileReadReq_t rd;
+
+        if (len < sizeof(rd)) break;
+        memcpy(&rd, payload, sizeof(rd));
+        FileRead(&rd);
+        return;
+    }
+
+    case FILE_CLOSE: {
+        if (len < sizeof(req) + 1) break;
+
+        uint8_t h = payload[sizeof(req)];
+        if (h >= FILE_MAX_OPEN || openFiles[h].fd == -1) {
+            FileReply(&req, -EBADF, NULL, 0);
+            return;
+        }
+
+        close(openFiles[h].fd);
+        openFiles[h].fd = -1;
+        FileReply(&req, 0, NULL, 0);
+        return;
+    }
+    }
+
+    FileReply(&req, -EINVAL, NULL, 0);
+}
+
+
+//
+// -- The session is over: close what the kernel left open and report on the file service
+//    ------------------------------------------------------------------------------------
+void FileFinish(void)
+{
+    for (int i = 0; i < FILE_MAX_OPEN; i ++) {
+        if (openFiles[i].fd != -1) close(openFiles[i].fd);
+        openFiles[i].fd = -1;
+    }
+
+    if (fileStats.requests) {
+        uint32_t lookups = fileStats.hits + fileStats.misses;
+
+        fprintf(stderr, "\nFile service: %u requests; %u bytes read in %u bytes of replies; "
+                "%u of %u blocks from the cache (%u read ahead)\n", fileStats.requests, fileStats.readBytes,
+                fileStats.replyBytes, fileStats.hits, lookups, fileStats.readAhead);
+    }
+
+    memset(&fileStats, 0, sizeof(fileStats));
+}
+
+
+//
+// -- A complete record has arrived on a channel
+//    ------------------------------------------
+static void ConsoleRecord(uint8_t chan, const uint8_t *payload, uint32_t len)
+{
+    switch (chan) {
+    case CHAN_LOG: {
+        static char text[LOG_TEXT_MAX];
+        uint32_t args[LOG_MAX_ARGS];
+        uint32_t fmtAddr;
+
+        if (len < 4 || len > 4 + sizeof(args) || len % 4) {
+            fprintf(stderr, "\nDiscarding a malformed log record (%d bytes)\n", len);
+            return;
+        }
+
+        memcpy(&fmtAddr, payload, 4);
+        memcpy(args, payload + 4, len - 4);
+
+        int out = LogFormat(text, sizeof(text), fmtAddr, args, (len - 4) / 4);
+        ConsoleText(text, out);
+
+        logRecords ++;
+        logWire += len + 4;
+        logText += out;
+        break;
+    }
+
+    case CHAN_PROF:
+        ProfileSamples(payload, len);
+        break;
+
+    case CHAN_UPLOAD:
+        UploadRecord(payload, len);
+        break;
+
+    case CHAN_FILE:
+        FileRequest(payload, len);
+        break;
+
+    default:
+        fprintf(stderr, "\nDiscarding a record on unknown channel 0x%02x (%d bytes)\n", chan, len);
+        break;
+    }
+}
+
+
+//
+// -- Write out the text collected so far
+//    -----------------------------------
+void ConsoleFlush(void)
+{
+    ConsoleText(conText, conTextLen);
+    conTextLen = 0;
+}
+
+
+//
+// -- Feed one byte of the console stream through the channel framing; returns true on a triple break
+//
+//    In text, DLE starts a record: DLE <channel> <length:16 LE> <payload>, and DLE DLE is a text DLE.  Breaks are
+//    only counted in text, so the bytes of a record can be anything.  `now` is when the byte was read, not when it
+//    is fed: the host can be busy for a while between reads.
+//    ------------------------------------------------------------------------------------------------------------
+bool ConsoleFeed(uint8_t b, int64_t now)
 {
-    memset(&mbi, 0, sizeof(mbi));
-    mbiSize = sizeof(struct MB1);
+    // -- a frame cut short by a reset would otherwise swallow the triple break
+    if (conState != CON_TEXT && now - conLast > CON_GAP_USEC) conState = CON_TEXT;
+    conLast = now;
+
+    switch (conState) {
+    case CON_TEXT:
+        if (b == '\x03') {
+            if (++ conBreaks < 3) return false;
+
+            conBreaks = 0;
+            ConsoleFlush();
+            return true;
+        }
+
+        // -- breaks that did not make 3 are just text
+        for ( ; conBreaks; conBreaks --) conText[conTextLen ++] = '\x03';
+
+        if (b == CON_DLE) conState = CON_DLE_SEEN;
+        else conText[conTextLen ++] = b;
+        break;
+
+    case CON_DLE_SEEN:
+        if (b == CON_DLE) {
+            conText[conTextLen ++] = b;
+            conState = CON_TEXT;
+        } else {
+            conChan = b;
+            conState = CON_LEN_LO;
+        }
+        break;
+
+    case CON_LEN_LO:
+        conLen = b;
+        conState = CON_LEN_HI;
+        break;
+
+    case CON_LEN_HI:
+        conLen |= b << 8;
+        conGot = 0;
+        conState = CON_PAYLOAD;
+        break;
+
+    case CON_PAYLOAD:
+        conPayload[conGot ++] = b;
+        break;
+    }
 
-    mbi.MB1.flags = (1<<3) | (1<<6);        // just module and memory info for now
+    // -- an empty record is complete as soon as its length arrives
+    if (conState == CON_PAYLOAD && conGot == conLen) {
+        ConsoleFlush();                     // -- keep the output in order
+        ConsoleRecord(conChan, conPayload, conLen);
+        conState = CON_TEXT;
+    }
+
+    // -- leave room for 2 held breaks and the next byte
+    if (conTextLen > sizeof(conText) - 4) ConsoleFlush();
+
+    return false;
+}
+
+
+//
+// -- Reset the framing and report on the binary log of the session that just ended
+//    -----------------------------------------------------------------------------
+void ConsoleReset(void)
+{
+    ConsoleFlush();
 
-    // -- local variable to fill in the data
-    Mb1MmapEntry_t *mmap = (Mb1MmapEntry_t *)&mbi.raw[mbiSize];
-    mmap->mmapAddr = 0;
-    mmap->mmapLength = 0x3f000000;
-    mmap->mmapSize = sizeof(Mb1MmapEntry_t) - 4;
-    mmap->mmapType = 1;
+    if (logRecords) {
+        fprintf(stderr, "\nBinary log: %d records in %d bytes on the wire for %d bytes of text (%.1fx)\n",
+                logRecords, logWire, logText, (double)logText / logWire);
+    }
 
-    // -- just 1 block of available memory
-    mbi.MB1.mmapAddr = 0xfe000 + mbiSize;
-    mbi.MB1.mmapLen = sizeof(Mb1MmapEntry_t);
-    mbiSize += sizeof(Mb1MmapEntry_t);
+    ProfileFinish();
+    UploadFinish();
+    FileFinish();
 
-    // -- no modules for now; will be added dynamically
+    conTxLen = conTxSent = 0;
+    conState = CON_TEXT;
+    conBreaks = 0;
+    logRecords = logWire = logText = 0;
 }
 
+
 //
 // -- Perform all the initialization steps
 //    ------------------------------------
@@ -451,6 +4606,9 @@ void Init(int argc, const char * const argv[])
     atexit(Cleanup);
     signal(SIGINT, SignalHandler);
 
+    // -- a socket that closes under a write is an error on the write, as it is on a tty
+    if (devTransport != XPORT_TTY) signal(SIGPIPE, SIG_IGN);
+
     // -- we need to save the old setting to restore, but copy them for our use
     newTio = oldTio;
 
@@ -463,39 +4621,100 @@ void Init(int argc, const char * const argv[])
         exit(EXIT_FAILURE);
     }
 
-    // -- initialize the config lines
-    for (int i = 0; i < MAX_CONFIG_LINES; i ++) {
-        cfgLines[i].type = NONE;
-        cfgLines[i].originalLine = NULL;
-        cfgLines[i].fileName = NULL;
-        cfgLines[i].fd = -1;
-        cfgLines[i].size = 0;
+    MilestoneInit();
+    PipeInit();
+
+    if (sessionName) SessionOpen();
+    if (devTransport == XPORT_REPLAY) ReplayLoad();
+
+    for (int i = 0; i < UPLOAD_MAX; i ++) uploads[i].fd = -1;
+    for (int i = 0; i < FILE_MAX_OPEN; i ++) openFiles[i].fd = -1;
+
+    // -- the binary log of the last session is reported on the way out
+    atexit(ConsoleReset);
+
+    // -- a kernel given for the log strings is used for every boot
+    if (logElfName) {
+        int fd = open(logElfName, O_RDONLY);
+        if (fd == -1) {
+            perror(logElfName);
+            exit(EXIT_FAILURE);
+        }
+
+        LogElfLoad(fd);
+    }
+}
+
+
+//
+// -- Ask the driver not to hold on to received bytes: ASYNC_LOW_LATENCY for the tty layer, and for a USB adapter
+//    with one (FTDI), the latency timer in sysfs.  Neither is an error when the driver does not have it; a pty
+//    has neither.
+//    -----------------------------------------------------------------------------------------------------------
+static void LowLatency(int fd, const char *name)
+{
+    struct serial_struct ss;
+    char real[PATH_MAX];
+    char path[PATH_MAX + 64];
+    char buf[16];
+
+    if (ioctl(fd, TIOCGSERIAL, &ss) == 0 && !(ss.flags & ASYNC_LOW_LATENCY)) {
+        ss.flags |= ASYNC_LOW_LATENCY;
+        if (ioctl(fd, TIOCSSERIAL, &ss) == -1) {
+            fprintf(stderr, "%s: cannot set low latency: %s\n", name, strerror(errno));
+        }
+    }
+
+    if (!realpath(name, real)) return;
+
+    const char *tty = strrchr(real, '/');
+    snprintf(path, sizeof(path), "/sys/class/tty/%s/device/latency_timer", tty ? tty + 1 : real);
+
+    int lt = open(path, O_RDWR);
+    if (lt == -1) {
+        if (errno == EACCES) {
+            fprintf(stderr, "%s: the latency timer cannot be changed without write access to %s\n", name, path);
+        }
+
+        return;
+    }
+
+    ssize_t len = read(lt, buf, sizeof(buf) - 1);
+    int was = (len > 0 ? (buf[len] = 0, atoi(buf)) : 0);
+
+    if (was > LATENCY_TIMER) {
+        len = snprintf(buf, sizeof(buf), "%d\n", LATENCY_TIMER);
+        if (pwrite(lt, buf, len, 0) == len) {
+            fprintf(stderr, "%s: latency timer %d ms (was %d)\n", name, LATENCY_TIMER, was);
+        } else {
+            fprintf(stderr, "%s: cannot set the latency timer: %s\n", name, strerror(errno));
+        }
     }
 
-    InitMbi();
+    close(lt);
 }
 
 
 //
 // -- Perform the low-level work to open the serial device and prepare it
 //    -------------------------------------------------------------------
-static void _OpenDev(void)
+static int _OpenDev(const char *name)
 {
     struct termios termios;     // -- The termios structure, to be configured for serial interface
 
     // -- Open the device, read/write, not the controlling tty, and non-blocking I/O
-    fdDev = open(dev, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    int fd = open(name, O_RDWR | O_NOCTTY | O_NONBLOCK);
 
-    if (fdDev == -1) return;
+    if (fd == -1) return -1;
 
     // -- must be a tty
-    if (!isatty(fdDev)) {
-        fprintf(stderr, "%s is not a tty\n", dev);
+    if (!isatty(fd)) {
+        fprintf(stderr, "%s is not a tty\n", name);
         exit(EXIT_FAILURE);
     }
 
     // -- Get the attributes
-    if(tcgetattr(fdDev, &termios) == -1) {
+    if(tcgetattr(fd, &termios) == -1) {
         perror("Failed to get attributes of device");
         exit(EXIT_FAILURE);
     }
@@ -504,10 +4723,10 @@ static void _OpenDev(void)
     termios.c_cc[VTIME] = 0;
     termios.c_cc[VMIN] = 0;
 
-    // -- 8N1 mode, no input/output/line processing masks
+    // -- 8N1 mode, no input/output/line processing masks, and RTS/CTS if asked for
     termios.c_iflag = 0;
     termios.c_oflag = 0;
-    termios.c_cflag = CS8 | CREAD | CLOCAL;
+    termios.c_cflag = CS8 | CREAD | CLOCAL | (rtsCts ? CRTSCTS : 0);
     termios.c_lflag = 0;
 
     // -- Set the baud rate
@@ -517,10 +4736,13 @@ static void _OpenDev(void)
     }
 
     // -- Write the attributes
-    if (tcsetattr(fdDev, TCSAFLUSH, &termios) == -1) {
+    if (tcsetattr(fd, TCSAFLUSH, &termios) == -1) {
         perror("tcsetattr()");
         exit(EXIT_FAILURE);
     }
+
+    LowLatency(fd, name);
+    return fd;
 }
 
 
@@ -531,6 +4753,10 @@ void Reinit(void)
 {
     fprintf(stderr, "\n### Listening to %s...      \n", dev);
 
+    // -- a run that has already seen milestones still counts
+    ConsoleReset();
+    MilestoneFinish();
+
     // -- Set fdDev non-blocking
     if (fcntl(fdDev, F_SETFL, O_NONBLOCK) == -1) {
         perror("fcntl()");
@@ -546,47 +4772,115 @@ void Reinit(void)
     FD_ZERO(&writeSet);
     FD_ZERO(&exceptSet);
 
-    // -- clear out the config lines
-    for (int i = 0; i < MAX_CONFIG_LINES; i ++) {
+    // -- close the files from the config lines
+    for (int i = 0; i < cfgCount; i ++) {
         if (cfgLines[i].fd != -1) close(cfgLines[i].fd);
-        cfgLines[i].type = NONE;
-        cfgLines[i].originalLine = NULL;
-        cfgLines[i].fileName = NULL;
-        cfgLines[i].fd = -1;
-        cfgLines[i].size = 0;
     }
 
-    // -- clear out the config file and elf hdr
-    memset(cfgFile, 0, MAX_CFG_FILE_SIZE);
-    memset(elfHdr, 0, MAX_CFG_FILE_SIZE);
-    InitMbi();
-
-    // -- reset the entry point and elf data
+    // -- clear out the config file, mbi, and plan, all of which live in the arena, and the elf hdr
+    ArenaReset();
+    cfgLines = NULL;
+    cfgCount = 0;
+    cfgFile = NULL;
+    mbi = NULL;
+    mbiSize = 0;
+    mbiLoc = 0;
+    plan = NULL;
+    planCap = 0;
+    planFramed = false;
+    imageSize = 0;
+    dedupTable = NULL;
+    dedupMask = 0;
+
+    // -- and let go of any pack file
+    if (packMap) munmap(packMap, packMapSize);
+    packMap = NULL;
+    packMapSize = 0;
+    packHdr = NULL;
+
+    // -- reset the entry point and the kernels
     entry = 0;
-    elfSects = 0;
-    phdr = 0;
+    cfgKernels = 0;
+    coreKernelCount = 0;
+    planCount = 0;
+    planKernelCount = 0;
 
     // -- we have reached this point and have a connection to the serial port; now we need to get into tty mode
     state = TTY;
 }
 
 
+//
+// -- Wait for the directory of the tty to change: the node is created, or udev gives it its owner and mode.  A
+//    /dev/serial/by-id link lives in a directory that only exists while something is plugged in, so the nearest
+//    directory that exists is watched, and that is looked for again every time; without inotify, this is the old
+//    1 second poll.
+//    ------------------------------------------------------------------------------------------------------------
+static void DevWait(void)
+{
+    const uint32_t mask = IN_CREATE | IN_ATTRIB | IN_MOVED_TO;
+    char dir[PATH_MAX];
+    char *slash;
+
+    if (fdWatch == -1) fdWatch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fdWatch == -1) {
+        sleep(1);
+        hotplugEvent = NowUsec();
+        return;
+    }
+
+    snprintf(dir, sizeof(dir), "%s", dev);
+    do {
+        slash = strrchr(dir, '/');
+        if (slash && slash != dir) *slash = 0;
+        else strcpy(dir, slash ? "/" : ".");
+    } while (inotify_add_watch(fdWatch, dir, mask) == -1 && errno == ENOENT && strlen(dir) > 1);
+
+    // -- any change is worth another try; the timeout is only there in case a change is missed
+    struct pollfd pfd = { .fd = fdWatch, .events = POLLIN };
+    uint8_t events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    if (poll(&pfd, 1, 1000) == 1) {
+        while (read(fdWatch, events, sizeof(events)) > 0) { }
+    }
+
+    hotplugEvent = NowUsec();
+}
+
+
 //
 // -- Open up the device and prepare it to be used -- initialize everything required
 //    ------------------------------------------------------------------------------
 void OpenDev(void)
 {
     if (fdDev != -1) close(fdDev);
+    if (fdStripe != -1) close(fdStripe);
     fdDev = -1;
+    fdStripe = -1;
     fdMax = 0;
+    hotplugWait = 0;
+    hotplugOpen = 0;
+    linkMeasured = false;
 
     while (1) {
-        _OpenDev();
+        if (devTransport == XPORT_TTY) fdDev = _OpenDev(dev);
+        else if (devTransport == XPORT_REPLAY) fdDev = ReplayOpen();
+        else fdDev = NetOpen();
         if (fdDev == -1) {
             // -- udev takes a while to change ownership so sometimes one gets EPERM
-            if (errno == ENOENT || errno == ENODEV || errno == EACCES) {
+            if (errno == ENOENT || errno == ENODEV || errno == EACCES || errno == EPERM || errno == ENXIO) {
+                if (!hotplugWait) hotplugWait = NowUsec();
+                fprintf(stderr, "\r### Waiting for %s...\r", dev);
+                DevWait();
+                continue;
+            }
+
+            // -- a serial server that is not up yet (or not reachable yet) is waited for the same way
+            if (errno == ECONNREFUSED || errno == ETIMEDOUT || errno == EHOSTUNREACH || errno == ENETUNREACH) {
+                if (!hotplugWait) hotplugWait = NowUsec();
                 fprintf(stderr, "\r### Waiting for %s...\r", dev);
                 sleep(1);
+                hotplugEvent = NowUsec();
                 continue;
             }
 
@@ -596,10 +4890,71 @@ void OpenDev(void)
         } else break;
     }
 
+    // -- the watch is only needed while the tty is missing
+    if (fdWatch != -1) close(fdWatch);
+    fdWatch = -1;
+    SessionRecord(SESS_OPEN, NULL, 0);
+
+    if (hotplugWait) {
+        hotplugOpen = NowUsec();
+        fprintf(stderr, "\n### %s appeared after %.3f sec; opened %.1f ms after the change\n", dev,
+                (hotplugEvent - hotplugWait) / 1e6, (hotplugOpen - hotplugEvent) / 1000.0);
+    }
+
+    // -- the second tty is only ever written, by the pipeline (non-blocking); without it the image goes over the first
+    if (stripeDev) {
+        fdStripe = _OpenDev(stripeDev);
+        if (fdStripe == -1) perror(stripeDev);
+    }
+
     Reinit();           // -- perform the variable initialization
 }
 
 
+//
+// -- The rpi sent a triple break: the session is over and the loader is waiting for the next config
+//    ----------------------------------------------------------------------------------------------
+void ConsoleRestart(void)
+{
+    // -- here we change into read the config mode
+    ConsoleReset();
+    MilestoneFinish();
+    AbNext();
+    fprintf(stderr, "Preparing to send %s data\n", cfg);
+    sessionStart = NowUsec();
+    traceCount = 0;
+    syncRounds = 0;
+    MilestoneArm();
+    state = CONFIG;
+}
+
+
+//
+// -- Pass along whatever console output the rpi has sent, without waiting for more; returns true on a triple
+//    break
+//    -------------------------------------------------------------------------------------------------------
+bool ConsoleDrain(void)
+{
+    char buf[1024];
+    struct timeval tv = { 0, 0 };
+    fd_set rd;
+
+    while (1) {
+        FD_ZERO(&rd);
+        FD_SET(fdDev, &rd);
+        if (select(fdDev + 1, &rd, NULL, NULL, &tv) != 1) return false;
+
+        ssize_t len = DevRead(buf, sizeof(buf));
+        if (len == -1 && errno == EAGAIN) continue;         // -- it was all telnet
+        if (len < 1) return false;
+
+        const int64_t now = NowUsec();
+        for (ssize_t i = 0; i < len; i ++) if (ConsoleFeed(buf[i], now)) return true;
+        ConsoleFlush();
+    }
+}
+
+
 //
 // -- Act as a TTY Terminal
 //    ---------------------
@@ -622,7 +4977,6 @@ void DoTty(void)
     FD_SET(fdDev, &exceptSet);
 
     while (1) {
-        int breaks = 0;
         bool didSomething = false;
 
         FD_ZERO(&readSet);
@@ -631,9 +4985,10 @@ void DoTty(void)
 
         FD_SET(STDIN_FILENO, &readSet);
         FD_SET(fdDev, &readSet);
+        if (conTxLen) FD_SET(fdDev, &writeSet);
 
         // -- block until we have something to do
-        if (select(fdMax, &readSet, NULL, &exceptSet, NULL) == -1) {
+        if (select(fdMax, &readSet, &writeSet, &exceptSet, NULL) == -1) {
             // -- if we get some error, assume we need to reset
             perror("select() function -- resetting");
             state = REINIT;
@@ -663,10 +5018,37 @@ void DoTty(void)
                 exit(EXIT_FAILURE);
             }
 
-            len = write(fdDev, buf, len);
+            // -- Ctrl-] is the server's own escape; with the file service, the replies share the line, so a DLE
+            //    typed at the keyboard is doubled
+            for (ssize_t i = 0; i < len; i ++) {
+                if (conEscape) {
+                    conEscape = false;
+
+                    if (buf[i] == 'r' || buf[i] == 'R') {
+                        fprintf(stderr, "\nAsking the kernel to return to the loader\n");
+                        ConsoleSend(WARM_MAGIC, WARM_MAGIC_LEN);
+                        warmAsked = NowUsec();
+                        continue;
+                    }
 
-            if (len == -1) {
-                perror("write() to tty");
+                    // -- anything else goes to the rpi as typed, with the Ctrl-] in front of it
+                    const char esc = CON_ESCAPE;
+                    if (buf[i] != CON_ESCAPE) ConsoleSend(&esc, 1);
+                } else if (buf[i] == CON_ESCAPE) {
+                    conEscape = true;
+                    continue;
+                }
+
+                ConsoleSend(&buf[i], 1);
+                if (fileRoot && buf[i] == CON_DLE) ConsoleSend(&buf[i], 1);
+            }
+
+            didSomething = true;
+        }
+
+        // -- room to write to the RPi (or something new to write)
+        if (conTxLen) {
+            if (!ConsoleTxFlush()) {
                 state = REINIT;
                 return;
             }
@@ -676,65 +5058,103 @@ void DoTty(void)
 
         // -- output from the RPi, copy to STDOUT
         if (FD_ISSET(fdDev, &readSet)) {
-            ssize_t len = read(fdDev, buf, BUF_SIZE);
-            const char *ptr = buf;
+            ssize_t len = DevRead(buf, BUF_SIZE);
 
+            if (len == -1 && errno == EAGAIN) return;      // -- it was all telnet
             if (len < 1) {          // if we don't get any data, treat it like an error
                 perror("read() from tty");
                 state = REINIT;
                 return;
             }
 
-            // -- we need to scan this rpi output for a triple break.  Start with a single one
-            while (ptr < &buf[len]) {
-                const char *brk = index(ptr, '\x03');
+            const int64_t now = NowUsec();
+            if (hotplugOpen) {
+                fprintf(stderr, "### First byte from %s %.1f ms after it was opened (%.3f sec after it went missing)\n",
+                        dev, (now - hotplugOpen) / 1000.0, (now - hotplugWait) / 1e6);
+                hotplugOpen = 0;
+            }
+
+            // -- pass the rpi output through the channel framing, watching for a triple break
+            for (ssize_t i = 0; i < len; i ++) {
+                if (!ConsoleFeed(buf[i], now)) continue;
 
-                if (brk == NULL) brk = &buf[len];
-                if (ptr == brk) {
-                    ++breaks;
-                    ++ptr;
+                if (i + 1 != len) {
+                    fprintf(stderr, "Discarding input after tripple break\n");
+                }
 
-                    if (breaks == 3) {
-                        if (ptr != &buf[len]) {
-                            fprintf(stderr, "Discarding input after tripple break\n");
-                        }
+                ConsoleRestart();
+                return;
+            }
 
-                        // -- here we change into read the config mode
-                        fprintf(stderr, "Preparing to send %s data\n", cfg);
-                        state = CONFIG;
-                        return;
-                    }
-                } else {
-                    while (breaks > 0) {
-                        ssize_t len2 = write(STDOUT_FILENO, "\x03\x03\x03", breaks);
-                        if (len2 == -1) {
-                            perror("write() to stdout");
-                            exit(EXIT_FAILURE);
-                        }
-
-                        breaks -= len2;
-                    }
+            ConsoleFlush();
+            didSomething = true;
+        }
 
-                    while (ptr < brk) {
-                        ssize_t len2 = write(STDOUT_FILENO, ptr, brk - ptr);
-                        if (len2 == -1) {
-                            perror("write() to stdout");
-                            exit(EXIT_FAILURE);
-                        }
+        if (!didSomething) {
+            state = REINIT;
+            return;
+        }
+    }
+}
+
+
+//
+// -- Memory map a pack file and point the mbi and the plan into it -- there is nothing else to prepare
+//    -------------------------------------------------------------------------------------------------
+void LoadPack(int fd, size_t size)
+{
+    if (size < sizeof(PackHdr_t)) {
+        fprintf(stderr, "Pack file %s is truncated\n", cfg);
+        state = REINIT;
+        return;
+    }
+
+    packMap = (uint8_t *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (packMap == MAP_FAILED) {
+        perror(cfg);
+        packMap = NULL;
+        state = REINIT;
+        return;
+    }
 
-                        ptr += len2;
-                    }
-                }
-            }
+    packMapSize = size;
+    packHdr = (PackHdr_t *)packMap;
 
-            didSomething = true;
-        }
+    if (packHdr->version != PACK_VERSION) {
+        fprintf(stderr, "Pack file %s is version %d; expected %d\n", cfg, packHdr->version, PACK_VERSION);
+        state = REINIT;
+        return;
+    }
 
-        if (!didSomething) {
-            state = REINIT;
-            return;
-        }
+    if ((uint64_t)packHdr->mbiOffset + packHdr->mbiSize > size
+            || (uint64_t)packHdr->payloadOffset + packHdr->payloadSize > size
+            || (uint64_t)packHdr->indexOffset + packHdr->blockCount * sizeof(PackIndex_t) > size
+            || packHdr->coreCount > MAX_CORES - 1
+            || (uint64_t)packHdr->coresOffset + packHdr->coreCount * sizeof(CoreKernel_t) > size) {
+        fprintf(stderr, "Pack file %s is truncated\n", cfg);
+        state = REINIT;
+        return;
     }
+
+    mbi = packMap + packHdr->mbiOffset;
+    mbiSize = packHdr->mbiSize;
+    mbiLoc = (KERNEL_LOC - mbiSize) & 0xfffff000;
+    entry = packHdr->entry;
+    imageSize = packHdr->imageSize;
+    smpSpin = (packHdr->flags & PACK_SPIN) != 0;
+    coreKernelCount = packHdr->coreCount;
+    memcpy(coreKernels, packMap + packHdr->coresOffset, coreKernelCount * sizeof(CoreKernel_t));
+
+    planCount = 0;
+    planCap = 1;
+    plan = (Extent_t *)ArenaAlloc(sizeof(Extent_t));
+    PlanAdd(EXT_MEM, -1, packHdr->payloadOffset, KERNEL_LOC, packHdr->payloadSize, basename(cfg));
+    planKernelCount = planCount;
+    planFramed = true;
+
+    fprintf(stderr, "Using pack file %s (%d blocks%s)\n", cfg, packHdr->blockCount,
+            packHdr->flags & PACK_COMPRESSED ? ", compressed" : "");
+    state = SEND_SIZE;
 }
 
 
@@ -744,6 +5164,7 @@ void DoTty(void)
 void ReadConfig(void)
 {
     int fdCfg = open(cfg, O_RDONLY);
+    struct stat st;
     int ln = 0;
 
     if (fdCfg == -1) {
@@ -752,15 +5173,43 @@ void ReadConfig(void)
         return;
     }
 
-    int len = read(fdCfg, cfgFile, MAX_CFG_FILE_SIZE);
+    if (fstat(fdCfg, &st) == -1) {
+        perror(cfg);
+        close(fdCfg);
+        state = REINIT;
+        return;
+    }
+
+    // -- a pack file has everything prepared already
+    char magic[sizeof(PACK_MAGIC)] = {0};
+    if (read(fdCfg, magic, sizeof(magic)) == sizeof(magic) && memcmp(magic, PACK_MAGIC, sizeof(magic)) == 0) {
+        LoadPack(fdCfg, st.st_size);
+        close(fdCfg);
+        return;
+    }
+
+    lseek(fdCfg, 0, SEEK_SET);
+
+    // -- the whole file is read into the arena; the extra byte keeps the last line terminated
+    cfgFile = (char *)ArenaAlloc(st.st_size + 1);
+    int len = read(fdCfg, cfgFile, st.st_size);
     close(fdCfg);
 
-    if (len == MAX_CFG_FILE_SIZE) {
-        fprintf(stderr, "Config file buffer overrun\n");
+    if (len != st.st_size) {
+        fprintf(stderr, "Unable to read all of %s\n", cfg);
         state = REINIT;
         return;
     }
 
+    // -- count the lines (an upper bound since blank lines are skipped) to allocate the config lines at once
+    int lines = 1;
+    for (int i = 0; i < len; i ++) {
+        if (cfgFile[i] == '\n' || cfgFile[i] == '\r') lines ++;
+    }
+
+    cfgLines = (ConfigLine_t *)ArenaAlloc(lines * sizeof(ConfigLine_t));
+    for (int i = 0; i < lines; i ++) cfgLines[i].fd = -1;
+
     // -- separate the lines into each own pointer
     bool setPtr = true;
     for (int i = 0; i < len; i ++) {
@@ -776,22 +5225,17 @@ void ReadConfig(void)
             cfgLines[ln++].originalLine = &cfgFile[i];
             setPtr = false;
         }
-
-        if (ln == MAX_CONFIG_LINES) {
-            fprintf(stderr, "Too many lines in %s; only %d lines supported\n", cfg, MAX_CONFIG_LINES);
-            state = REINIT;
-            return;
-        }
     }
 
+    cfgCount = ln;
     state = CHECK;
 }
 
 
 //
-// -- Trim a line of trailing blanks and return just the file name
-//    ------------------------------------------------------------
-char *Trim(char *var)
+// -- Trim a line of trailing blanks and return just the file name; anything after the file name is attributes
+//    --------------------------------------------------------------------------------------------------------
+char *Trim(char *var, char **attrs)
 {
     int pos = 6;                                                // -- skip past the keyword
     if (!var) return NULL;
@@ -799,17 +5243,75 @@ char *Trim(char *var)
     int ll = strlen(var) - 1;
     while (var[ll] == ' ' || var[ll] == '\t') var[ll--] = 0;
 
+    // -- the file name ends at the next blank
+    char *end = var + pos + strcspn(var + pos, " \t");
+    if (*end) *end++ = 0;
+    while (*end == ' ' || *end == '\t') end ++;
+    *attrs = end;
+
     return var + pos;
 }
 
 
+//
+// -- Parse the `key=value` attributes that follow the file name on a config line
+//    ---------------------------------------------------------------------------
+bool ParseAttrs(ConfigLine_t *line, char *attrs, int ln)
+{
+    char *save = NULL;
+
+    for (char *tok = strtok_r(attrs, " \t", &save); tok; tok = strtok_r(NULL, " \t", &save)) {
+        char *val = strchr(tok, '=');
+        char *end = NULL;
+
+        if (val) *val++ = 0;
+
+        if (val && strcmp(tok, "align") == 0 && line->type == MODULE) {
+            // -- a power of 2, in bytes or with a K suffix
+            unsigned long align = strtoul(val, &end, 0);
+            if (*end == 'K' || *end == 'k') {
+                align *= 1024;
+                end ++;
+            }
+
+            if (*end || align == 0 || (align & (align - 1)) || align > 0x100000) {
+                fprintf(stderr, "config file line %d has an invalid alignment: %s\n", ln, val);
+                return false;
+            }
+
+            line->align = align;
+        } else if (val && strcmp(tok, "core") == 0 && line->type == KERNEL) {
+            line->core = strtol(val, &end, 0);
+            if (*end || line->core < 0 || line->core >= MAX_CORES) {
+                fprintf(stderr, "config file line %d has an invalid core: %s\n", ln, val);
+                return false;
+            }
+        } else if (val && strcmp(tok, "smp") == 0 && line->type == KERNEL) {
+            // -- `go` sends the APs to the entry point with core 0; `spin` leaves them for the kernel to release
+            if (strcmp(val, "spin") == 0) line->spin = true;
+            else if (strcmp(val, "go") == 0) line->spin = false;
+            else {
+                fprintf(stderr, "config file line %d has an invalid smp mode: %s\n", ln, val);
+                return false;
+            }
+        } else {
+            fprintf(stderr, "config file line %d has an invalid attribute: %s\n", ln, tok);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
 //
 // -- Parse an elf kernel file, and adjust the byte count properly for the bss and header
 //    -----------------------------------------------------------------------------------
-void ParseElf(void)
+void ParseElf(ConfigLine_t *line)
 {
-    int byteCnt = 0;
-    const int fd = cfgLines[0].fd;          // just to make the code a little easier to read
+    uint32_t kernelEnd = KERNEL_LOC;
+    const int fd = line->fd;                // just to make the code a little easier to read
+    uint8_t *elfHdr = (uint8_t *)ArenaAlloc(4096);     // this is a modest buffer size for 1 elf page
 
     if (read(fd, elfHdr, 4096) != 4096) {
         perror("Kernel ELF not big enough\n");
@@ -844,18 +5346,282 @@ void ParseElf(void)
         return;
     }
 
-    entry = ehdr->e_entry;
+    line->entry = ehdr->e_entry;
+
+    if (ehdr->e_phoff + (uint32_t)ehdr->e_phnum * sizeof(Elf32_Phdr_t) > 4096) {
+        fprintf(stderr, "The program headers are not in the first page of the kernel\n");
+        state = REINIT;
+        return;
+    }
+
+    Elf32_Phdr_t *phdr = (Elf32_Phdr_t *)((char *)ehdr + ehdr->e_phoff);
+    line->phdr = phdr;
+    line->elfSects = ehdr->e_phnum;
+
+    // -- each segment is loaded at its physical address, so the kernel ends at the end of the highest one
+    for (int i = 0; i < line->elfSects; i ++) {
+        if (phdr[i].p_type != PT_LOAD || phdr[i].p_memsz == 0) continue;
+
+        if (phdr[i].p_paddr < KERNEL_LOC || phdr[i].p_filesz > phdr[i].p_memsz) {
+            fprintf(stderr, "Kernel segment %d at %x cannot be loaded\n", i, phdr[i].p_paddr);
+            state = REINIT;
+            return;
+        }
+
+        if (phdr[i].p_paddr + phdr[i].p_memsz > kernelEnd) kernelEnd = phdr[i].p_paddr + phdr[i].p_memsz;
+    }
+
+    line->end = kernelEnd;
+    line->size = kernelEnd - KERNEL_LOC;
+
+    // -- the rest is only for the kernel on core 0
+    if (line != &cfgLines[0]) return;
+    entry = line->entry;
+
+    // -- once it boots, its log strings are read from here
+    if (!logElfName) {
+        int logFd = dup(fd);
+        if (logFd != -1) LogElfLoad(logFd);
+    }
+}
+
+
+//
+// -- Sort ranges by their start
+//    --------------------------
+static int CompareRange(const void *a, const void *b)
+{
+    const Range_t *ra = (const Range_t *)a;
+    const Range_t *rb = (const Range_t *)b;
+
+    return (ra->start > rb->start) - (ra->start < rb->start);
+}
+
+
+//
+// -- The memory map for the kernel on line k: what the loader keeps, and the segments, modules and mbi of every
+//    other kernel, are reserved (type 2); the rest is available (type 1).  Returns the entries; with no map, it
+//    returns the most entries the map can need.
+//    ----------------------------------------------------------------------------------------------------------
+static int MbiMemoryMap(int k, Mb1MmapEntry_t *map)
+{
+    int max = 1;
+
+    for (int j = 0; j < cfgCount; j ++) {
+        if (j == k || cfgLines[j].type == NONE) continue;
+        if (cfgLines[j].type == KERNEL) max += cfgLines[j].elfSects + 1;
+        else if (cfgLines[j].kernel != k) max ++;
+    }
+
+    if (!map) return 2 * max + 1;
+
+    Range_t *r = (Range_t *)ArenaAlloc(max * sizeof(Range_t));
+    int n = 0;
+
+    r[n ++] = (Range_t){ LOADER_START, LOADER_END };
+
+    for (int j = 0; j < cfgCount; j ++) {
+        const ConfigLine_t *line = &cfgLines[j];
+
+        if (j == k) continue;
+
+        if (line->type == KERNEL) {
+            for (int i = 0; i < line->elfSects; i ++) {
+                if (line->phdr[i].p_type != PT_LOAD || line->phdr[i].p_memsz == 0) continue;
+                r[n ++] = (Range_t){ line->phdr[i].p_paddr, line->phdr[i].p_paddr + line->phdr[i].p_memsz };
+            }
+
+            r[n ++] = (Range_t){ line->mbiAddr, line->mbiAddr + line->mbiSize };
+        } else if (line->type == MODULE && line->kernel != k && line->size) {
+            r[n ++] = (Range_t){ line->addr, line->addr + line->size };
+        }
+    }
+
+    qsort(r, n, sizeof(Range_t), CompareRange);
+
+    // -- walk up memory: the gap before each (merged) reserved range is available
+    int e = 0;
+    uint32_t at = 0;
+
+    for (int i = 0; i < n; ) {
+        uint32_t start = r[i].start;
+        uint32_t end = r[i].end;
+
+        for (i ++; i < n && r[i].start <= end; i ++) if (r[i].end > end) end = r[i].end;
+        if (start < at) start = at;
+        if (end <= start) continue;
+
+        if (start > at) map[e ++] = (Mb1MmapEntry_t){ sizeof(Mb1MmapEntry_t) - 4, at, start - at, 1 };
+        map[e ++] = (Mb1MmapEntry_t){ sizeof(Mb1MmapEntry_t) - 4, start, end - start, 2 };
+        at = end;
+    }
+
+    if (at < RPI_MEMORY) map[e ++] = (Mb1MmapEntry_t){ sizeof(Mb1MmapEntry_t) - 4, at, RPI_MEMORY - at, 1 };
+
+    return e;
+}
+
+
+//
+// -- Build the MBI for each kernel, sized to its content: the header, the memory map, the module table, and the
+//    string table.  They are placed one after the other, the one for core 0 first.
+//    -----------------------------------------------------------------------------------------------------------
+void BuildMbi(void)
+{
+    const uint32_t mmapOffset = sizeof(MB1_t);
+
+    // -- first, the size of each one; every module belongs to the kernel above it
+    mbiSize = 0;
+    for (int k = 0; k < cfgCount; k ++) {
+        if (cfgLines[k].type != KERNEL) continue;
+
+        uint32_t size = mmapOffset + MbiMemoryMap(k, NULL) * sizeof(Mb1MmapEntry_t);
+        for (int m = k + 1; m < cfgCount && cfgLines[m].type == MODULE; m ++) {
+            size += sizeof(Mb1Mods_t) + strlen(cfgLines[m].basename) + 1;
+        }
+
+        cfgLines[k].mbiAddr = mbiSize;          // -- an offset until mbiLoc is known
+        cfgLines[k].mbiSize = (size + 7) & ~7;
+        mbiSize += cfgLines[k].mbiSize;
+    }
+
+    mbiLoc = (KERNEL_LOC - mbiSize) & 0xfffff000;
+    mbi = (uint8_t *)ArenaAlloc(mbiSize);
+    memset(mbi, 0, mbiSize);
+    coreKernelCount = 0;
+
+    // -- each memory map reserves the other kernels' mbis, so they all need their addresses first
+    for (int k = 0; k < cfgCount; k ++) if (cfgLines[k].type == KERNEL) cfgLines[k].mbiAddr += mbiLoc;
+
+    for (int k = 0; k < cfgCount; k ++) {
+        if (cfgLines[k].type != KERNEL) continue;
+
+        const uint32_t loc = cfgLines[k].mbiAddr;
+        uint8_t *base = &mbi[loc - mbiLoc];
+        uint32_t modCount = 0;
+
+        while (k + 1 + modCount < (uint32_t)cfgCount && cfgLines[k + 1 + modCount].type == MODULE) modCount ++;
+
+        MB1_t *hdr = (MB1_t *)base;
+        hdr->flags = (1<<3) | (1<<6) | (1<<8);  // module and memory info, and the loader's page as the config table
+        hdr->configTable = PBL_INFO;
+
+        // -- the memory map, with what the loader and the other kernels use reserved
+        const int entries = MbiMemoryMap(k, (Mb1MmapEntry_t *)&base[mmapOffset]);
+        const uint32_t modOffset = mmapOffset + entries * sizeof(Mb1MmapEntry_t);
+        uint32_t strOffset = modOffset + (modCount * sizeof(Mb1Mods_t));
+
+        hdr->mmapAddr = loc + mmapOffset;
+        hdr->mmapLen = entries * sizeof(Mb1MmapEntry_t);
+
+        // -- the modules, each with its name in the string table
+        Mb1Mods_t *modArray = (Mb1Mods_t *)&base[modOffset];
+        hdr->modAddr = loc + modOffset;
+        hdr->modCount = modCount;
+
+        for (uint32_t m = 0; m < modCount; m ++) {
+            ConfigLine_t *line = &cfgLines[k + 1 + m];
+
+            modArray[m].modStart = line->addr;
+            modArray[m].modEnd = line->addr + line->size;
+            modArray[m].modIdent = loc + strOffset;
+            strcpy((char *)&base[strOffset], line->basename);
+            strOffset += strlen(line->basename) + 1;
+        }
+
+        // -- the kernels on the other cores are started with their own entry point and mbi
+        if (k > 0) {
+            CoreKernel_t *ck = &coreKernels[coreKernelCount ++];
+            ck->core = cfgLines[k].core;
+            ck->entry = cfgLines[k].entry;
+            ck->mbi = loc;
+        }
+    }
+}
+
+
+//
+// -- Plan the image: the kernel segments at their physical addresses (bss zeroed), then each module at its
+//    alignment.  Nothing is sent for the gaps between them.
+//    -----------------------------------------------------------------------------------------------------
+void PlanImage(void)
+{
+    uint32_t oldPadding = 0;                // what padding everything to 4K used to cost on the wire
+    uint32_t planned = 0;
+    int sects = 0;
+
+    for (int k = 0; k < cfgCount; k ++) if (cfgLines[k].type == KERNEL) sects += cfgLines[k].elfSects;
+
+    planCount = 0;
+    planCap = 2 * (sects + cfgCount);
+    plan = (Extent_t *)ArenaAlloc(planCap * sizeof(Extent_t));
+    cfgLines[0].addr = KERNEL_LOC;
+    modLocation = KERNEL_LOC;
+
+    // -- every kernel's segments, at their physical addresses; no two kernels may share any memory
+    for (int k = 0; k < cfgCount; k ++) {
+        const ConfigLine_t *kl = &cfgLines[k];
+        const Elf32_Phdr_t *phdr = kl->phdr;
+
+        if (kl->type != KERNEL) continue;
+
+        for (int i = 0; i < kl->elfSects; i ++) {
+            if (phdr[i].p_type != PT_LOAD || phdr[i].p_memsz == 0) continue;
+
+            uint32_t addr = phdr[i].p_paddr;
+            for (int e = 0; e < planCount; e ++) {
+                if (plan[e].name != kl->basename && addr < plan[e].addr + plan[e].len
+                        && plan[e].addr < addr + phdr[i].p_memsz) {
+                    fprintf(stderr, "Kernel %s segment at %x overlaps %s\n", kl->basename, addr, plan[e].name);
+                    state = REINIT;
+                    return;
+                }
+            }
+
+            if (!PlanAdd(EXT_FILE, kl->fd, phdr[i].p_offset, addr, phdr[i].p_filesz, kl->basename)
+                    || !PlanAdd(EXT_ZERO, -1, 0, addr + phdr[i].p_filesz, phdr[i].p_memsz - phdr[i].p_filesz,
+                            kl->basename)) {
+                state = REINIT;
+                return;
+            }
+
+            planned += phdr[i].p_memsz;
+            oldPadding += (-phdr[i].p_memsz) & 0xfff;
+        }
+
+        if (kl->end > modLocation) modLocation = kl->end;
+    }
+
+    planKernelCount = planCount;
+
+    // -- the modules follow the highest kernel, each at its own alignment (the ready flags are only for 1 kernel)
+    for (int m = 1, mod = 0; m < cfgCount; m ++) {
+        if (cfgLines[m].type != MODULE) continue;
 
-    phdr = (Elf32_Phdr_t *)((char *)ehdr + ehdr->e_phoff);
-    elfSects = ehdr->e_phnum;
+        uint32_t align = cfgLines[m].align;
 
-    for (int i = 0; i < elfSects; i ++) {
-        byteCnt += phdr[i].p_memsz;
-        if (byteCnt & 0xfff) byteCnt = (byteCnt & 0xfffff000) + 0x1000;
+        modLocation = (modLocation + align - 1) & ~(align - 1);
+        cfgLines[m].addr = modLocation;
+
+        if (!PlanAdd(EXT_FILE, cfgLines[m].fd, 0, modLocation, cfgLines[m].size, cfgLines[m].basename)
+                || (earlyStart && cfgKernels == 1
+                        && !PlanAdd(EXT_MARK, -1, mod ++, modLocation, 0, cfgLines[m].basename))) {
+            state = REINIT;
+            return;
+        }
+
+        modLocation += cfgLines[m].size;
+        planned += cfgLines[m].size;
+        oldPadding += (-cfgLines[m].size) & 0xfff;
     }
 
-    cfgLines[0].size = byteCnt;
-    cfgLines[0].padding = 0;                // we took care of that in this function
+    imageSize = modLocation - KERNEL_LOC;
+
+    fprintf(stderr, "Layout: %d bytes of padding eliminated; %d bytes in alignment gaps are not sent\n",
+            oldPadding, imageSize - planned);
+
+    DedupInit(imageSize);
+    BuildMbi();
 }
 
 
@@ -864,10 +5630,16 @@ void ParseElf(void)
 //    ----------------------------------------------
 void CheckConfig(void)
 {
-    for (int i = 0; i < MAX_CONFIG_LINES; i ++) {
-        // -- no need to process an empty line
-        if (cfgLines[i].originalLine == NULL) continue;
+    uint32_t coresUsed = 0;
+    int kernel = 0;
+
+    if (cfgCount == 0) {
+        fprintf(stderr, "config file %s is empty\n", cfg);
+        state = REINIT;
+        return;
+    }
 
+    for (int i = 0; i < cfgCount; i ++) {
         // -- determine the keyword for the line
         if (strncmp(cfgLines[i].originalLine, "kernel", 6) == 0) cfgLines[i].type = KERNEL;
         else if (strncmp(cfgLines[i].originalLine, "module", 6) == 0) cfgLines[i].type = MODULE;
@@ -877,54 +5649,298 @@ void CheckConfig(void)
             return;
         }
 
-        // now calidate the keyword for this line: i == 0 can only be kernel; 1 to (MAX_CONFIG_LINES-1) only module
+        // now calidate the keyword for this line: i == 0 can only be kernel
         if (i == 0 && cfgLines[i].type != KERNEL) {
             fprintf(stderr, "The top config line must contain the 'kernel' keyword\n");
             state = REINIT;
             return;
         }
 
-        if (i > 0 && cfgLines[i].type != MODULE) {
-            fprintf(stderr, "All lines but the top line must contain the 'module' keyword\n");
+        // -- isolate the file name
+        char *attrs = NULL;
+        cfgLines[i].fileName = Trim(cfgLines[i].originalLine, &attrs);
+        cfgLines[i].align = DEFAULT_MOD_ALIGN;
+        cfgLines[i].spin = false;
+        cfgLines[i].core = 0;
+
+        if (cfgLines[i].fileName == NULL) {
+            fprintf(stderr, "config file %s has an empty file name on line %d\n", cfg, i + 1);
+            state = REINIT;
+            return;
+        }
+
+        cfgLines[i].basename = basename(cfgLines[i].fileName);
+
+        if (!ParseAttrs(&cfgLines[i], attrs, i + 1)) {
+            state = REINIT;
+            return;
+        }
+
+        // -- each kernel after the top one starts its own group of modules, on a core of its own
+        if (cfgLines[i].type == KERNEL) {
+            if ((i == 0) != (cfgLines[i].core == 0) || (coresUsed & (1 << cfgLines[i].core))
+                    || (i > 0 && cfgLines[i].spin)) {
+                fprintf(stderr, "config file line %d: the top kernel runs on core 0 (and may have `smp=`); every other "
+                        "kernel needs a `core=` of its own\n", i + 1);
+                state = REINIT;
+                return;
+            }
+
+            coresUsed |= 1 << cfgLines[i].core;
+            kernel = i;
+            cfgKernels ++;
+        }
+
+        cfgLines[i].kernel = kernel;
+        if (i == 0) smpSpin = cfgLines[0].spin;
+
+        // -- now open the file
+        cfgLines[i].fd = open(cfgLines[i].fileName, O_RDONLY);
+        if (cfgLines[i].fd == -1) {
+            perror(cfgLines[i].fileName);
+            state = REINIT;
+            return;
+        }
+
+        // -- check the size
+        cfgLines[i].size = lseek(cfgLines[i].fd, 0L, SEEK_END);
+        lseek(cfgLines[i].fd, 0L, SEEK_SET);
+        if (cfgLines[i].size == 0) {
+            fprintf(stderr, "Empty file %s cannot be sent\n", cfgLines[i].fileName);
             state = REINIT;
             return;
         }
+    }
+
+    // -- now, go read some of each kernel and fix the sizes up
+    for (int i = 0; i < cfgCount; i ++) {
+        if (cfgLines[i].type != KERNEL) continue;
+
+        ParseElf(&cfgLines[i]);
+        if (state == REINIT) return;
+    }
+
+    // -- and lay out everything that will be sent
+    PlanImage();
+    if (state == REINIT) return;
+
+    state = SEND_SIZE;
+}
+
+
+//
+// -- Read a record from the rpi, which sends it immediately; returns the number of bytes that arrived
+//    ------------------------------------------------------------------------------------------------
+ssize_t ReadRecord(void *rec, size_t size)
+{
+    uint8_t *t = (uint8_t *)rec;
+    size_t got = 0;
+
+    while (got < size) {
+        struct timeval tv = {1, 0};         // -- give it a second
+        fd_set set;
+
+        FD_ZERO(&set);
+        FD_SET(fdDev, &set);
+
+        int res = select(fdDev + 1, &set, NULL, NULL, &tv);
+        if (res == -1) {
+            perror("select() on tty");
+            return -1;
+        }
+
+        if (res == 0) break;
+
+        ssize_t len = DevRead(t + got, size - got);
+        if (len == -1 && errno == EAGAIN) continue;
+        if (len < 1) {
+            perror("read() record from tty");
+            return -1;
+        }
+
+        got += len;
+    }
+
+    return got;
+}
+
+
+//
+// -- Record a span on the trace of this session
+//    ------------------------------------------
+void TraceSpan(Track_t track, const char *name, int64_t start, int64_t end)
+{
+    if (traceCount == TRACE_MAX) return;
+
+    trace[traceCount].name = name;
+    trace[traceCount].track = track;
+    trace[traceCount].start = start;
+    trace[traceCount].end = end;
+    traceCount ++;
+}
+
+
+//
+// -- Ping the rpi once: the NTP offset and round trip, corrected for the 1 byte out and 9 bytes back
+//    -----------------------------------------------------------------------------------------------
+bool Ping(SyncSample_t *sample)
+{
+    uint8_t cmd = CMD_PING;
+    uint8_t reply[9];
+    uint32_t t1, t2;
+
+    int64_t t0 = NowUsec();
+    if (DevWrite(&cmd, 1) != 1) {
+        perror("ping write()");
+        return false;
+    }
+
+    if (ReadRecord(reply, sizeof(reply)) != sizeof(reply) || reply[0] != CMD_PING) {
+        fprintf(stderr, "The rpi did not answer the clock sync ping\n");
+        return false;
+    }
+
+    int64_t t3 = NowUsec();
+    memcpy(&t1, reply + 1, 4);
+    memcpy(&t2, reply + 5, 4);
+
+    if (syncRounds == 0 && syncBaseHost == 0) {
+        syncBaseHost = t0;
+        syncBasePi = t1;
+    }
+
+    // -- everything relative to the first ping; the rpi timer is only 32 bits
+    const double h0 = t0 - syncBaseHost;
+    const double h3 = t3 - syncBaseHost;
+    const double p1 = (int32_t)(t1 - syncBasePi);
+    const double p2 = (int32_t)(t2 - syncBasePi);
+
+    sample->host = (h0 + h3) / 2;
+    sample->offset = ((p1 - h0) - (h3 - p2)) / 2 + 4 * BYTE_USEC;
+    sample->error = ((h3 - h0) - (p2 - p1) - 10 * BYTE_USEC) / 2;
+    sample->rtt = h3 - h0;
+    if (sample->error < 1) sample->error = 1;           // -- the rpi timer only has 1 usec resolution
+
+    return true;
+}
+
+
+//
+// -- Run a round of clock sync pings and keep the best one; after the second round the drift is known
+//    ------------------------------------------------------------------------------------------------
+bool ClockSync(void)
+{
+    const int round = syncRounds;
+    const int64_t start = NowUsec();
+    SyncSample_t sample;
+    int64_t rtt[SYNC_PINGS];
+
+    if (round == 0) syncBaseHost = 0;
+
+    for (int i = 0; i < SYNC_PINGS; i ++) {
+        if (!Ping(&sample)) return false;
+        if (i == 0 || sample.error < syncBest[round].error) syncBest[round] = sample;
+        rtt[i] = sample.rtt;
+    }
+
+    // -- every handshake costs a round trip, and it is mostly the adapter (the ping is 10 bytes on the wire)
+    if (!linkMeasured) {
+        qsort(rtt, SYNC_PINGS, sizeof(int64_t), CompareUsec);
+        fprintf(stderr, "Link: a ping comes back in %.2f ms (%.2f to %.2f ms); its 10 bytes take %.2f ms at 115200\n",
+                rtt[SYNC_PINGS / 2] / 1000.0, rtt[0] / 1000.0, rtt[SYNC_PINGS - 1] / 1000.0, 10 * BYTE_USEC / 1000);
+        if (rtt[0] - 10 * BYTE_USEC > 4000) {
+            fprintf(stderr, "Link: the adapter is holding bytes back; is its latency timer still at the default?\n");
+        }
+
+        linkMeasured = true;
+    }
+
+    syncRounds = round + 1;
+    TraceSpan(TRACK_HOST, "clock sync", start, NowUsec());
+
+    if (round == 0) {
+        syncDrift = 0;
+        fprintf(stderr, "Clock sync: the rpi timer was at %.6f s when the host was at %.6f s (+/- %.0f usec)\n",
+                (syncBasePi + syncBest[0].offset + syncBest[0].host) / 1e6,
+                (syncBaseHost + syncBest[0].host) / 1e6, syncBest[0].error);
+    } else {
+        // -- the drift is only as good as the errors at both ends over the time between them
+        const double span = syncBest[1].host - syncBest[0].host;
+        const double drift = (syncBest[1].offset - syncBest[0].offset) / span;
+        const double bound = (syncBest[0].error + syncBest[1].error) / span;
+
+        syncDrift = (drift > bound || drift < -bound ? drift : 0);
+        fprintf(stderr, "Clock sync: the rpi clock drifts %+.1f ppm (+/- %.1f ppm) from the host; "
+                "now +/- %.0f usec\n", drift * 1e6, bound * 1e6, syncBest[1].error);
+    }
+
+    return true;
+}
+
+
+//
+// -- Put an rpi system timer value on the host clock
+//    -----------------------------------------------
+int64_t PiToHost(uint32_t pi)
+{
+    const double p = (int32_t)(pi - syncBasePi);
+    const SyncSample_t *a = &syncBest[0];
+
+    // -- p = h + offset(h), where offset(h) = a->offset + drift * (h - a->host)
+    return syncBaseHost + (int64_t)((p - a->offset + syncDrift * a->host) / (1 + syncDrift));
+}
+
+
+//
+// -- Write the trace of this session in Chrome trace (and Perfetto) JSON: one track for the host, one for the rpi
+//    -----------------------------------------------------------------------------------------------------------
+void WriteTrace(const Telemetry_t *tel)
+{
+    static const char *phase[TEL_COUNT] = {
+        "serial init", "greeting", "waiting for the server", "handshake", "image", "mbi", "entry point",
+    };
 
-        // -- isolate the file name
-        cfgLines[i].fileName = Trim(cfgLines[i].originalLine);
-        strcpy(cfgLines[i].basename, basename(cfgLines[i].fileName));
+    if (!traceName) return;
 
-        if (cfgLines[i].fileName == NULL) {
-            fprintf(stderr, "config file %s has an empty file name on line %d\n", cfg, i + 1);
-            state = REINIT;
-            return;
-        }
+    // -- the rpi phases go on the host clock, if the clocks were synchronized
+    if (tel && syncRounds) {
+        uint32_t ts[TEL_COUNT];
+        memcpy(ts, tel->stamp, sizeof(ts));
 
-        // -- now open the file
-        cfgLines[i].fd = open(cfgLines[i].fileName, O_RDONLY);
-        if (cfgLines[i].fd == -1) {
-            perror(cfgLines[i].fileName);
-            state = REINIT;
-            return;
+        if (!(tel->flags & TEL_WARM)) TraceSpan(TRACK_RPI, "firmware", PiToHost(0), PiToHost(ts[TEL_START]));
+        for (int i = TEL_START; i < TEL_ENTRY; i ++) {
+            TraceSpan(TRACK_RPI, phase[i], PiToHost(ts[i]), PiToHost(ts[i + 1]));
         }
+    }
 
-        // -- check the size
-        cfgLines[i].size = lseek(cfgLines[i].fd, 0L, SEEK_END);
-        lseek(cfgLines[i].fd, 0L, SEEK_SET);
-        if (cfgLines[i].size == 0) {
-            fprintf(stderr, "Empty file %s cannot be sent\n", cfgLines[i].fileName);
-            state = REINIT;
-            return;
-        }
+    FILE *fp = fopen(traceName, "w");
+    if (!fp) {
+        perror(traceName);
+        return;
+    }
+
+    int64_t base = sessionStart;
+    for (int i = 0; i < traceCount; i ++) if (trace[i].start < base) base = trace[i].start;
 
-        // -- adjsut the size up to the next 4K
-        if (cfgLines[i].size & 0xfff) cfgLines[i].padding = 0x1000 - (cfgLines[i].size & 0xfff);
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"pbl-server\"}},\n", TRACK_HOST);
+    fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"rpi\"}}", TRACK_RPI);
+
+    for (int i = 0; i < traceCount; i ++) {
+        fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":1,\"ts\":%lld,\"dur\":%lld}", trace[i].name,
+                trace[i].track, (long long)(trace[i].start - base), (long long)(trace[i].end - trace[i].start));
     }
 
-    // -- now, go read some of the kernel and fix the size up
-    ParseElf();
+    if (syncRounds) {
+        const SyncSample_t *best = &syncBest[syncRounds - 1];
+        fprintf(fp, ",\n{\"name\":\"clock sync\",\"ph\":\"i\",\"s\":\"g\",\"pid\":%d,\"tid\":1,\"ts\":0,"
+                "\"args\":{\"rpi_minus_host_us\":%.1f,\"error_us\":%.1f,\"drift_ppm\":%.2f}}",
+                TRACK_HOST, (double)syncBasePi - syncBaseHost + best->offset, best->error, syncDrift * 1e6);
+    }
 
-    state = SEND_SIZE;
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+    fprintf(stderr, "The trace of this boot is in %s\n", traceName);
 }
 
 
@@ -933,15 +5949,11 @@ void CheckConfig(void)
 //    --------------------------------------------------
 void SendSize(void)
 {
-    int totalSize = 0;
+    uint32_t totalSize = imageSize;
     char *sz = (char *)&totalSize;
-    int i;
     char resp;
 
-    for (i = 0; i < MAX_CONFIG_LINES; i ++) {
-        totalSize += (cfgLines[i].size + cfgLines[i].padding);
-    }
-
+    TraceSpan(TRACK_HOST, "config", sessionStart, NowUsec());
     fprintf(stderr, "Notifying the RPi that %d bytes will be sent\n", totalSize);
 
     // -- Set fdDev blocking
@@ -951,22 +5963,57 @@ void SendSize(void)
         return;
     }
 
-    // -- Send the size
-    if (write(fdDev, sz, 4) == -1) {
-        perror(dev);
+    // -- Synchronize the clocks while the rpi is waiting for commands
+    if (!ClockSync()) {
         state = REINIT;
         return;
     }
 
-    // -- wait for a character
-    int cnt;
-    while ((cnt = read(fdDev, &resp, 1)) == 0) {
-        if (cnt == -1) {
+    // -- Ask the rpi to take the image over both UARTs; a loader built without striping NAKs the command
+    stripeActive = false;
+    if (fdStripe != -1) {
+        char cmd = CMD_STRIPE;
+        char ans = 0;
+
+        if (DevWrite(&cmd, 1) == -1 || ReadRecord(&ans, 1) == -1) {
             perror(dev);
             state = REINIT;
             return;
         }
-        sleep(1);
+
+        if (ans == CMD_STRIPE) {
+            tcflush(fdStripe, TCIOFLUSH);
+            stripeActive = true;
+            fprintf(stderr, "Striping the image over %s and %s\n", dev, stripeDev);
+        } else {
+            fprintf(stderr, "The rpi loader was built without striping; sending over %s only\n", dev);
+        }
+    }
+
+    // -- Send the size; with early start the kernel is booted before the modules are sent (a pack file is already
+    //    framed as one image, so it is always sent in full)
+    lateModules = earlyStart && !planFramed && coreKernelCount == 0 && planKernelCount < planCount;
+    if (earlyStart && planFramed) fprintf(stderr, "Early start is not possible with a pack file; sending it all\n");
+    else if (earlyStart && coreKernelCount) {
+        fprintf(stderr, "Early start is not possible with more than one kernel; sending it all\n");
+    }
+
+    char cmd = (lateModules ? CMD_SIZE_EARLY : CMD_SIZE);
+    phaseStart = NowUsec();
+    transferStart = phaseStart;
+    if (DevWrite(&cmd, 1) == -1 || DevWrite(sz, 4) == -1) {
+        perror(dev);
+        state = REINIT;
+        return;
+    }
+
+    // -- wait for a character
+    ssize_t cnt;
+    while ((cnt = ReadRecord(&resp, 1)) == 0) { }
+
+    if (cnt == -1) {
+        state = REINIT;
+        return;
     }
 
     if (resp != '\x06') {
@@ -975,19 +6022,42 @@ void SendSize(void)
         return;
     }
 
-    modLocation = 0x100000 + cfgLines[0].size;
+    TraceSpan(TRACK_HOST, "size", phaseStart, NowUsec());
     state = SEND_KERNEL;
 }
 
 
 //
-// -- Send the kernel to the pi, as a prepared elf file
-//    -------------------------------------------------
+// -- Report the progress of the pipeline, naming the extent currently being written
+//    ------------------------------------------------------------------------------
+static void ReportProgress(const char *what, int first, int last)
+{
+    uint32_t sent = atomic_load(&pipeRawSent);
+    uint32_t pos = 0;
+    const char *name = what;
+
+    for (int i = 0; i < last; i ++) {
+        if (i >= first && sent < pos + plan[i].len) {
+            name = plan[i].name;
+            break;
+        }
+
+        pos += plan[i].len;
+    }
+
+    fprintf(stderr, "Sending %s %s (%d bytes sent)...\r", what, name, atomic_load(&pipeBytesSent));
+}
+
+
+//
+// -- Send the kernel to the pi, as a prepared elf file; the pipeline continues on into the modules unless they
+//    are to be sent after the kernel has started
+//    ---------------------------------------------------------------------------------------------------------
 void SendKernel(void)
 {
-    #define bufSize   1024*64
-    static uint8_t kBuf[bufSize];       // 64 K buffer on the .bss section
-    int bytesSent = 0;
+    uint32_t kernelBytes = 0;
+
+    for (int i = 0; i < planKernelCount; i ++) kernelBytes += plan[i].len;
     fprintf(stderr, "Sending kernel...\r");
 
     // -- Set fdDev blocking
@@ -997,59 +6067,24 @@ void SendKernel(void)
         return;
     }
 
-    // -- there are several sections to send
-    for (int i = 0; i < elfSects; i ++) {
-        int sectBytes = phdr[i].p_filesz;
-
-        if (lseek(cfgLines[0].fd, phdr[i].p_offset, SEEK_SET) == -1) {
-            perror(cfgLines[0].fileName);
-            state = REINIT;
-            return;
-        }
-
-        while (sectBytes > 0) {
-            int bytes = read(cfgLines[0].fd, kBuf, (sectBytes>bufSize?bufSize:sectBytes));
-            if (bytes == -1) {
-                perror("read() kernel");
-                state = REINIT;
-                return;
-            }
-
-            int res = write(fdDev, kBuf, bytes);
-            if (res == -1) {
-                perror("sect write() to dev");
-                state = REINIT;
-                return;
-            }
-
-            sectBytes -= bytes;
-            bytesSent += bytes;
-            fprintf(stderr, "Sending kernel (%d bytes sent)...\r", bytesSent);
-        }
-
-        sectBytes = phdr[i].p_memsz - phdr[i].p_filesz;
-        if (phdr[i].p_memsz & 0xfff) sectBytes += (0x1000 - (phdr[i].p_memsz & 0xfff));
+    pipeFd = fdDev;
+    imageStart = NowUsec();
+    PipeStart(0, lateModules ? planKernelCount : planCount);
+    pipeFinished = false;
 
-        memset(kBuf, 0, bufSize);
-
-        while (sectBytes > 0) {
-            int bytes = (sectBytes>bufSize?bufSize:sectBytes);
-            int res = write(fdDev, kBuf, bytes);
-            if (res == -1) {
-                perror("padding write() to dev");
-                state = REINIT;
-                return;
-            }
+    while (!pipeFinished && atomic_load(&pipeRawSent) < kernelBytes) {
+        pipeFinished = PipeWait();
+        ReportProgress("kernel", 0, planKernelCount);
+    }
 
-            sectBytes -= bytes;
-            bytesSent += bytes;
-            fprintf(stderr, "Sending kernel (%d bytes sent)...\r", bytesSent);
-        }
+    if (atomic_load(&pipeError)) {
+        while (!pipeFinished) pipeFinished = PipeWait();
+        state = REINIT;
+        return;
     }
 
     state = SEND_MODULES;
     fprintf(stderr, "The kernel has been sent                      \n");
-    #undef bufSize
 }
 
 
@@ -1059,10 +6094,40 @@ void SendKernel(void)
 void SendEntry(void)
 {
     char *b = (char *)&entry;
-    fprintf(stderr, "Sending the Entry point as %x\n", entry);
+    char cmd = (smpSpin ? CMD_ENTRY_SPIN : CMD_ENTRY);
 
-    int res = write(fdDev, b, 4);
-    if (res == -1) {
+    // -- a second round of clock sync, now that some time has passed, gives the drift
+    if (!ClockSync()) {
+        state = REINIT;
+        return;
+    }
+
+    // -- the cores with a kernel of their own are told about it first; the entry command releases them all
+    for (int i = 0; i < coreKernelCount; i ++) {
+        const CoreKernel_t *ck = &coreKernels[i];
+        const char core = CMD_CORE;
+        char ack;
+
+        fprintf(stderr, "Starting %x on core %d with its mbi at %x\n", ck->entry, ck->core, ck->mbi);
+
+        if (DevWrite(&core, 1) == -1 || DevWrite(ck, sizeof(CoreKernel_t)) == -1) {
+            perror("core kernel write()");
+            state = REINIT;
+            return;
+        }
+
+        if (ReadRecord(&ack, 1) != 1 || ack != '\x06') {
+            fprintf(stderr, "The rpi loader cannot start core %d in its own kernel (is it older than the server?)\n",
+                    ck->core);
+            state = REINIT;
+            return;
+        }
+    }
+
+    fprintf(stderr, "Sending the Entry point as %x%s\n", entry, smpSpin ? " (the kernel releases the other cores)" : "");
+    phaseStart = NowUsec();
+
+    if (DevWrite(&cmd, 1) == -1 || DevWrite(b, 4) == -1) {
         perror("entry point write()");
         state = REINIT;
         return;
@@ -1070,15 +6135,147 @@ void SendEntry(void)
 
     char ack;
 
-    while (read(fdDev, &ack, 1) == 0) {}
-    if (ack != '\x06') {
+    if (ReadRecord(&ack, 1) != 1 || ack != '\x06') {
         fprintf(stderr, "failed to get ACK after entry");
         state = REINIT;
         return;
     }
 
+    TraceSpan(TRACK_HOST, "entry point", phaseStart, NowUsec());
+    AbRecord(0, NowUsec() - transferStart);
+    if (!milestoneCount) AbReport();
+    state = RECV_TELEMETRY;
+}
+
+
+//
+// -- Print the session report: the rpi's own timing of each phase next to what the host saw
+//    --------------------------------------------------------------------------------------
+void ReportSession(const Telemetry_t *tel)
+{
+    uint32_t ts[TEL_COUNT];
+    memcpy(ts, tel->stamp, sizeof(ts));         // -- the record is packed
+
+    const double hostMs = (imageEnd - imageStart) / 1000.0;
+    const double imageMs = (ts[TEL_IMAGE_END] - ts[TEL_IMAGE]) / 1000.0;
+    const double rate = imageMs > 0 ? tel->imageBytes / imageMs : 0;       // bytes/ms is KB/s
+    const uint32_t sent = atomic_load(&pipeBytesSent);
+
+    fprintf(stderr, "Session report (rpi system timer):\n");
+    if (!(tel->flags & TEL_WARM)) {
+        fprintf(stderr, "  %-26s %10.3f ms\n", "power on to loader", ts[TEL_START] / 1000.0);
+    } else if (warmAsked && warmAsked < sessionStart) {
+        fprintf(stderr, "  %-26s %10.3f ms (warm restart, on the host)\n", "kernel back to the loader",
+                (sessionStart - warmAsked) / 1000.0);
+    } else {
+        fprintf(stderr, "  %-26s %10s\n", "power on to loader", "(warm restart)");
+    }
+
+    warmAsked = 0;
+    fprintf(stderr, "  %-26s %10.3f ms\n", "serial init", (ts[TEL_SERIAL] - ts[TEL_START]) / 1000.0);
+    fprintf(stderr, "  %-26s %10.3f ms\n", "waiting for the server", (ts[TEL_SIZE] - ts[TEL_GREETING]) / 1000.0);
+    fprintf(stderr, "  %-26s %10.3f ms\n", "size to first image byte", (ts[TEL_IMAGE] - ts[TEL_SIZE]) / 1000.0);
+    fprintf(stderr, "  %-26s %10.3f ms (%.3f ms on the host)\n", "image", imageMs, hostMs);
+    fprintf(stderr, "  %-26s %10.3f ms\n", "mbi", (ts[TEL_MBI_END] - ts[TEL_IMAGE_END]) / 1000.0);
+    fprintf(stderr, "  %-26s %10.3f ms\n", "entry point", (ts[TEL_ENTRY] - ts[TEL_MBI_END]) / 1000.0);
+    fprintf(stderr, "  %-26s %10.3f ms\n", "total in the loader", (ts[TEL_ENTRY] - ts[TEL_START]) / 1000.0);
+    fprintf(stderr, "  image received at %.2f KB/s (%.0f%% of the line rate); the longest stall was %.3f ms after %d bytes\n",
+            rate, rate * 100000.0 / LINE_RATE, tel->maxStall / 1000.0, tel->maxStallAt);
+    fprintf(stderr, "  uart: %d bytes received, %d overruns, %d bad blocks\n", tel->rxBytes, tel->overruns, tel->badBlocks);
+
+    if (tel->imageBytes != sent) {
+        fprintf(stderr, "  the rpi received %d image bytes but %d were sent\n", tel->imageBytes, sent);
+    }
+}
+
+
+//
+// -- Print the PMU profile: where the loader spends its cycles, and what that means for the line rate
+//    ------------------------------------------------------------------------------------------------
+void ReportProfile(const Profile_t *prof, const Telemetry_t *tel)
+{
+    static const char *regionName[PMU_REGIONS] = { "bss", "other", "idle", "spin", "store", "crc", "mbi" };
+    const PmuRegion_t *r = prof->region;
+
+    fprintf(stderr, "PMU profile (events %02x %02x %02x %02x: L1D refill, L1I refill, br mispredict, st stall):\n",
+            prof->eventId[0], prof->eventId[1], prof->eventId[2], prof->eventId[3]);
+    fprintf(stderr, "  %-6s %14s %10s %9s %10s %10s %10s %10s\n", "region", "cycles", "bytes", "cyc/byte",
+            "ev0", "ev1", "ev2", "ev3");
+
+    for (int i = 0; i < PMU_REGIONS; i ++) {
+        fprintf(stderr, "  %-6s %14llu %10u ", regionName[i], (unsigned long long)r[i].cycles, r[i].bytes);
+        if (r[i].bytes) fprintf(stderr, "%9.1f", (double)r[i].cycles / r[i].bytes);
+        else fprintf(stderr, "%9s", "-");
+        fprintf(stderr, " %10u %10u %10u %10u\n", r[i].events[0], r[i].events[1], r[i].events[2], r[i].events[3]);
+    }
+
+    // -- the image phase is spin + store + crc; its cycles over its time gives the cpu clock
+    const uint64_t imageCycles = r[PMU_SPIN].cycles + r[PMU_STORE].cycles + r[PMU_CRC].cycles;
+    const uint64_t workCycles = r[PMU_STORE].cycles + r[PMU_CRC].cycles;
+    const uint32_t usec = tel->stamp[TEL_IMAGE_END] - tel->stamp[TEL_IMAGE];
+
+    if (!tel->imageBytes || !usec || !workCycles) return;
+
+    const double mhz = (double)imageCycles / usec;
+    const double work = (double)workCycles / tel->imageBytes;
+
+    fprintf(stderr, "  %.1f cycles per received byte (%.1f of them working) at about %.0f MHz; "
+            "the receive path could keep up with about %.0f baud\n",
+            (double)imageCycles / tel->imageBytes, work, mhz, mhz * 1e6 * 10 / work);
+}
+
+
+//
+// -- Receive the telemetry record; a loader that does not send one is just giving us console output
+//    ----------------------------------------------------------------------------------------------
+void ReceiveTelemetry(void)
+{
+    Telemetry_t tel;
+    uint8_t *t = (uint8_t *)&tel;
+    const int64_t start = NowUsec();
+    ssize_t got = ReadRecord(&tel, sizeof(Telemetry_t));
+    bool valid = false;
+
+    if (got == -1) {
+        state = REINIT;
+        return;
+    }
+
+    if (got == sizeof(Telemetry_t) && memcmp(tel.magic, TEL_MAGIC, 4) == 0 && tel.version == TEL_VERSION
+            && tel.size == sizeof(Telemetry_t) && Crc32(0, t, sizeof(Telemetry_t) - sizeof(uint32_t)) == tel.crc) {
+        valid = true;
+        ReportSession(&tel);
+
+        if (tel.flags & TEL_PMU) {
+            static Profile_t prof;
+
+            got = ReadRecord(&prof, sizeof(Profile_t));
+            if (got == -1) {
+                state = REINIT;
+                return;
+            }
+
+            if (got == sizeof(Profile_t) && memcmp(prof.magic, PROFILE_MAGIC, 4) == 0 && prof.regions == PMU_REGIONS
+                    && prof.events == PMU_EVENTS
+                    && Crc32(0, (uint8_t *)prof.region, sizeof(prof.region)) == prof.crc) {
+                ReportProfile(&prof, &tel);
+            } else {
+                fprintf(stderr, "The rpi PMU profile was not received\n");
+            }
+        }
+    } else {
+        fprintf(stderr, "The rpi did not send its telemetry\n");
+        if (got && write(STDOUT_FILENO, t, got) == -1) {
+            perror("write() to stdout");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    TraceSpan(TRACK_HOST, "telemetry", start, NowUsec());
+    WriteTrace(valid ? &tel : NULL);
+
     fprintf(stderr, "Waiting for the rpi to boot\n");
-    state = TTY;
+    state = (lateModules ? SEND_LATE : TTY);
 }
 
 
@@ -1087,7 +6284,6 @@ void SendEntry(void)
 //    ----------------------------------------------
 void SendMbiSize(void)
 {
-    mbiSize = 8192;             // we need the whole structure based on the string locations
     char *sz = (char *)&mbiSize;
     char resp;
 
@@ -1098,22 +6294,22 @@ void SendMbiSize(void)
         return;
     }
 
+    phaseStart = NowUsec();
+
     // -- Send the size
-    if (write(fdDev, sz, 4) == -1) {
+    if (DevWrite(sz, 4) == -1) {
         perror(dev);
         state = REINIT;
         return;
     }
 
     // -- wait for a character
-    int cnt;
-    while ((cnt = read(fdDev, &resp, 1)) == 0) {
-        if (cnt == -1) {
-            perror(dev);
-            state = REINIT;
-            return;
-        }
-        sleep(1);
+    ssize_t cnt;
+    while ((cnt = ReadRecord(&resp, 1)) == 0) { }
+
+    if (cnt == -1) {
+        state = REINIT;
+        return;
     }
 
     if (resp != '\x06') {
@@ -1133,14 +6329,14 @@ void SendMbi(void)
 {
     char ack;
 
-    int res = write(fdDev, &mbi, mbiSize);
+    int res = DevWrite(mbi, mbiSize);
     if (res == -1) {
         perror("mbi write() to dev");
         state = REINIT;
         return;
     }
 
-    while ((res = read(fdDev, &ack, 1)) == 0) { }
+    while ((res = DevRead(&ack, 1)) == 0 || (res == -1 && errno == EAGAIN)) { }
 
     if (res == -1) {
         perror("Get Ack after mbi\n");
@@ -1159,94 +6355,41 @@ void SendMbi(void)
         return;
     }
 
+    TraceSpan(TRACK_HOST, "mbi", phaseStart, NowUsec());
     state = SEND_ENTRY;
 }
 
 
 //
-// -- Send the modules to the rpi
-//    ---------------------------
+// -- Finish sending the modules to the rpi, which the pipeline has already started
+//    -----------------------------------------------------------------------------
 void SendModules(void)
 {
-    #define bufSize   1024*64
-    mbi.MB1.modAddr = 0xfe000 + mbiSize;
-    mbi.MB1.modCount = 0;
-    Mb1Mods_t *modArray = (Mb1Mods_t *)&mbi.raw[mbiSize];
-
-    for (int m = 1; m < MAX_CONFIG_LINES; m ++) {
-        if (cfgLines[m].type == NONE) continue;
-
-        // -- update the mbi with this module information
-        modArray[mbi.MB1.modCount].modStart = modLocation;
-        modArray[mbi.MB1.modCount].modEnd = modLocation + cfgLines[m].size + cfgLines[m].padding;
-        modArray[mbi.MB1.modCount].modIdent = (uint32_t)(0x100000 - 34 - (m * 34));
-        strcpy((char *)&mbi.raw[8192 - 34 - (m * 34)], cfgLines[m].basename);
-        modLocation += (cfgLines[m].size + cfgLines[m].padding);
-        mbiSize += sizeof(Mb1Mods_t);
-        mbi.MB1.modCount ++;
-
-        static uint8_t mBuf[bufSize];       // 64 K buffer on the .bss section
-        int bytesSent = 0;
-
-        // -- Set fdDev blocking
-        if (fcntl(fdDev, F_SETFL, 0) == -1) {
-            perror("fcntl()");
-            state = REINIT;
-            return;
-        }
-
-        int sectBytes = cfgLines[m].size;
-
-        if (lseek(cfgLines[m].fd, 0, SEEK_SET) == -1) {
-            perror(cfgLines[m].fileName);
-            state = REINIT;
-            return;
-        }
-
-        while (sectBytes > 0) {
-            int bytes = read(cfgLines[m].fd, mBuf, (sectBytes>bufSize?bufSize:sectBytes));
-            if (bytes == -1) {
-                perror("read() modules");
-                state = REINIT;
-                return;
-            }
-
-            int res = write(fdDev, mBuf, bytes);
-            if (res == -1) {
-                perror("sect write() to dev");
-                state = REINIT;
-                return;
-            }
-
-            sectBytes -= bytes;
-            bytesSent += bytes;
-            fprintf(stderr, "Sending module %s (%d bytes sent)...\r", cfgLines[m].basename, bytesSent);
-        }
-
-        sectBytes = cfgLines[m].padding;
-        memset(mBuf, 0, bufSize);
+    while (!pipeFinished) {
+        pipeFinished = PipeWait();
+        ReportProgress("module", planKernelCount, planCount);
+    }
 
-        while (sectBytes > 0) {
-            int bytes = (sectBytes>bufSize?bufSize:sectBytes);
-            int res = write(fdDev, mBuf, bytes);
-            if (res == -1) {
-                perror("padding write() to dev");
-                state = REINIT;
-                return;
-            }
+    if (atomic_load(&pipeError)) {
+        state = REINIT;
+        return;
+    }
 
-            sectBytes -= bytes;
-            bytesSent += bytes;
-            fprintf(stderr, "Sending module %s (%d bytes sent)...\r", cfgLines[m].basename, bytesSent);
-        }
+    if (lateModules) {
+        fprintf(stderr, "\rDone: %d kernel bytes in %d bytes on the wire; the modules follow once it starts       \n",
+                atomic_load(&pipeRawSent), atomic_load(&pipeBytesSent));
+    } else {
+        fprintf(stderr, "\rDone: %d image bytes in %d bytes on the wire (crc32 %08x)                          \n",
+                imageSize, atomic_load(&pipeBytesSent), packHdr ? packHdr->imageCrc : imageCrc);
     }
 
-    fprintf(stderr, "\rDone                                                                        \n");
+    if (dedupPages) fprintf(stderr, "  %d duplicate pages were copied on the rpi\n", dedupPages);
+    StripeReport();
 
     char ack;
     int res;
 
-    while ((res = read(fdDev, &ack, 1)) == 0) { }
+    while ((res = DevRead(&ack, 1)) == 0 || (res == -1 && errno == EAGAIN)) { }
 
     if (res == -1) {
         perror("Get Ack after kernel/modules\n");
@@ -1254,8 +6397,13 @@ void SendModules(void)
         return;
     }
 
+    imageEnd = NowUsec();
+    TraceSpan(TRACK_HOST, "image", imageStart, imageEnd);
+
     if (ack != '\x06') {
-        fprintf(stderr, "Never got ACK after kernel/modules\n");
+        fprintf(stderr, "The rpi reported a bad block in the kernel/modules\n");
+        state = REINIT;
+        return;
     }
 
     // -- Set fdDev non-blocking
@@ -1266,18 +6414,167 @@ void SendModules(void)
     }
 
     state = SEND_MBI_SIZE;
-    #undef bufSize
 }
 
 
+//
+// -- Early start: the kernel is running, so send the modules now; the rpi flags each one for the kernel as its
+//    last block lands.  The kernel has the console, so its output is passed along while the modules go out.
+//    ---------------------------------------------------------------------------------------------------------
+void SendLateModules(void)
+{
+    bool restarted = false;
+
+    // -- Set fdDev blocking for the writer
+    if (fcntl(fdDev, F_SETFL, 0) == -1) {
+        perror("fcntl()");
+        state = REINIT;
+        return;
+    }
+
+    fprintf(stderr, "Sending the modules while the kernel starts\n");
+    phaseStart = NowUsec();
+    PipeStart(planKernelCount, planCount);
+    pipeFinished = false;
+
+    while (!pipeFinished) {
+        pipeFinished = PipeWait();
+
+        // -- a triple break means the rpi reset; there is nobody left to send the modules to
+        if (!restarted && ConsoleDrain()) {
+            restarted = true;
+            atomic_store(&pipeError, true);
+        }
+    }
+
+    ConsoleFlush();
+
+    if (restarted) {
+        fprintf(stderr, "\nThe rpi restarted before the modules were sent\n");
+        if (devTransport == XPORT_TTY) tcflush(fdDev, TCIOFLUSH);
+        ConsoleRestart();
+        return;
+    }
+
+    if (atomic_load(&pipeError)) {
+        state = REINIT;
+        return;
+    }
+
+    fprintf(stderr, "\nDone: %d module bytes in %d bytes on the wire while the kernel ran (%.2f sec)\n",
+            atomic_load(&pipeRawSent), atomic_load(&pipeBytesSent), (NowUsec() - phaseStart) / 1e6);
+    if (dedupPages) fprintf(stderr, "  %d duplicate pages were copied on the rpi\n", dedupPages);
+    StripeReport();
+
+    // -- Set fdDev non-blocking
+    if (fcntl(fdDev, F_SETFL, O_NONBLOCK) == -1) {
+        perror("fcntl()");
+        state = REINIT;
+        return;
+    }
+
+    state = TTY;
+}
+
+
+//
+// -- Write a pack file: the header, the mbi, the framed payload (from the pipeline), and the block index
+//    ---------------------------------------------------------------------------------------------------
+void WritePack(void)
+{
+    PackHdr_t hdr;
+    int fd = open(packName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd == -1) {
+        perror(packName);
+        exit(EXIT_FAILURE);
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, PACK_MAGIC, sizeof(PACK_MAGIC));
+    hdr.version = PACK_VERSION;
+    hdr.flags = (compress ? PACK_COMPRESSED : 0) | (smpSpin ? PACK_SPIN : 0);
+    hdr.entry = entry;
+    hdr.imageSize = imageSize;
+    hdr.mbiOffset = sizeof(PackHdr_t);
+    hdr.mbiSize = mbiSize;
+    hdr.coresOffset = (hdr.mbiOffset + mbiSize + 7) & ~7;
+    hdr.coreCount = coreKernelCount;
+    hdr.payloadOffset = (hdr.coresOffset + coreKernelCount * sizeof(CoreKernel_t) + 7) & ~7;
+
+    const ssize_t coresSize = coreKernelCount * sizeof(CoreKernel_t);
+    if (pwrite(fd, mbi, mbiSize, hdr.mbiOffset) != mbiSize
+            || pwrite(fd, coreKernels, coresSize, hdr.coresOffset) != coresSize
+            || lseek(fd, hdr.payloadOffset, SEEK_SET) == -1) {
+        perror(packName);
+        exit(EXIT_FAILURE);
+    }
+
+    // -- each pipeline buffer can add at most 2 partial blocks to the ones its size accounts for
+    uint32_t maxBufs = imageSize / PIPE_BUF_SIZE + planCount + 1;
+    packIndex = (PackIndex_t *)ArenaAlloc((imageSize / BLOCK_SIZE + 2 * maxBufs + 1) * sizeof(PackIndex_t));
+
+    pipeFd = fd;
+    PipeStart(0, planCount);
+    while (!PipeWait()) { }
+
+    if (atomic_load(&pipeError)) exit(EXIT_FAILURE);
+
+    hdr.imageCrc = imageCrc;
+    hdr.payloadSize = atomic_load(&pipeBytesSent);
+    hdr.indexOffset = (hdr.payloadOffset + hdr.payloadSize + 7) & ~7;
+    hdr.blockCount = blocksSent;
+
+    ssize_t idxSize = blocksSent * sizeof(PackIndex_t);
+    if (pwrite(fd, packIndex, idxSize, hdr.indexOffset) != idxSize
+            || pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+        perror(packName);
+        exit(EXIT_FAILURE);
+    }
+
+    close(fd);
+    printf("%s: %d image bytes in %d blocks (%d duplicate pages), %d bytes on the wire, entry %x, "
+            "mbi %d bytes (crc32 %08x)\n", packName, imageSize, blocksSent, dedupPages, hdr.payloadSize, entry,
+            mbiSize, imageCrc);
+}
+
+
+#ifdef PBL_PACK
+//
+// -- This is the main entry point for pbl-pack: prepare everything the server would once, and save it
+//    ------------------------------------------------------------------------------------------------
+int main(int argc, const char * const argv[])
+{
+    ParseCommandLine(argc, argv);
+    PipeInit();
+
+    ReadConfig();
+    if (packHdr) {
+        fprintf(stderr, "%s is already a pack file\n", cfg);
+        exit(EXIT_FAILURE);
+    }
+
+    if (state == CHECK) CheckConfig();
+    if (state != SEND_SIZE) exit(EXIT_FAILURE);
+
+    WritePack();
+    return EXIT_SUCCESS;
+}
+#else
 //
 // -- This is the main entry point
 //    ----------------------------
 int main(int argc, const char * const argv[])
 {
+    State_t last = EXIT;
+
     Init(argc, argv);
 
     while(state != EXIT) {
+        // -- each change of state is recorded (-w), and in a replay checked against the recording
+        if (state != last) SessionState(state);
+        last = state;
+
         switch (state) {
         case EXIT:                  // -- technically this should never happen, but loop to exit
             continue;
@@ -1311,7 +6608,7 @@ int main(int argc, const char * const argv[])
             break;
 
         case SEND_MODULES:
-            SendModules();          // -- send the modules to the rpi (a file as-is, but padded to 4K)
+            SendModules();          // -- send the modules to the rpi (a file as-is, at its alignment)
             continue;
 
         case SEND_MBI_SIZE:
@@ -1326,11 +6623,20 @@ int main(int argc, const char * const argv[])
             SendEntry();            // -- send the entry point to the rpi
             break;
 
+        case RECV_TELEMETRY:
+            ReceiveTelemetry();     // -- get the rpi telemetry and report on the session
+            break;
+
+        case SEND_LATE:
+            SendLateModules();      // -- send the modules while the kernel runs (early start)
+            break;
+
         default:
             break;
         }
     }
 }
+#endif
 
 
 
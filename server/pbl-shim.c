@@ -0,0 +1,451 @@
+//===================================================================================================================
+//
+//  pbl-shim.c -- A bad serial line on demand, between 2 ptys, for measuring the server and the loader
+//
+//          Copyright (c)  2018 -- Adam Clark
+//          Licensed under the BEER-WARE License, rev42 (see LICENSE.md)
+//
+//  `pbl-shim` makes 2 ptys and passes the bytes between them the way a real serial line would: no faster than the
+//  baud rate allows, after a fixed latency, and with the drops, bit flips and bursts of noise it is asked for.
+//  `pbl-server` opens one end (the host link) and a loader stand-in opens the other (the rpi link).  The impairments
+//  come from a seeded generator, so the same seed and the same traffic give the same errors every time.  Each time
+//  the line goes quiet, the shim reports what it passed each way: the raw throughput, the throughput of the bytes
+//  that arrived intact (the goodput of the line), and what it did to the rest.
+//
+//  Like the server, this is a 1-source-file program with its state in globals.
+//
+// ------------------------------------------------------------------------------------------------------------------
+//
+//     Date      Tracker  Version  Pgmr  Description
+//  -----------  -------  -------  ----  ---------------------------------------------------------------------------
+//  2026-Oct-18  Initial   0.0.1   ADCL  Initial version
+//
+//===================================================================================================================
+
+
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <signal.h>
+#include <termios.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+
+
+//
+// -- The bytes each direction can hold before the shim stops reading that side (as a real line would push back)
+//    ----------------------------------------------------------------------------------------------------------
+#define QUEUE_SIZE              (1 << 18)
+
+
+//
+// -- After this long with no bytes either way, the traffic so far is reported
+//    ------------------------------------------------------------------------
+#define REPORT_IDLE_USEC        1000000
+
+
+//
+// -- One direction of the line: the bytes on their way, each with the time it comes out the other end
+//    -------------------------------------------------------------------------------------------------
+typedef struct {
+    const char *name;
+    int from;                   // the pty master the bytes are read from
+    int to;                     // and the one they are written to
+    bool impair;
+    uint8_t data[QUEUE_SIZE];
+    int64_t due[QUEUE_SIZE];
+    uint32_t head, tail;        // free running; the queue holds tail - head bytes
+    double lineFree;            // when the line has finished the last byte it was given (in fractions of usec)
+    int burstLeft;              // the bytes of the current burst of noise still to come
+    uint64_t bytesIn;           // the counts since the last report
+    uint64_t delivered;
+    uint64_t intact;
+    uint64_t dropped;
+    uint64_t flipped;
+    uint64_t noise;
+    uint64_t bursts;
+    int64_t first, last;        // when the first byte went in and the last one came out
+} Dir_t;
+
+
+//
+// -- These are the global variables; the options first
+//    -------------------------------------------------
+uint32_t baud = 115200;                 // -b: the rate cap (0 for none)
+double latencyMs = 0;                   // -l: the latency each way
+double dropRate = 0;                    // -d: the chance a byte is dropped
+double flipRate = 0;                    // -f: the chance a byte has a bit flipped
+double burstRate = 0;                   // -n: the chance a burst of noise starts at a byte
+int burstLen = 0;                       //     and how many bytes it garbles
+bool rpiOnly = false;                   // -r: only the bytes to the rpi are impaired
+uint64_t seed = 1;                      // -s: the seed of the impairments
+const char *hostLink = NULL;            // the pty for pbl-server
+const char *rpiLink = NULL;             // and the one for the loader stand-in
+
+Dir_t toRpi, toHost;
+int slaves[2] = { -1, -1 };             // held open, so a master never sees the other end hang up
+volatile sig_atomic_t quit = 0;
+int64_t lastActive = 0;
+
+
+//
+// -- The host monotonic clock in usec
+//    --------------------------------
+static int64_t NowUsec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+//
+// -- The impairment generator (xorshift64*), so a seed always gives the same errors
+//    ------------------------------------------------------------------------------
+static uint64_t Random(void)
+{
+    seed ^= seed >> 12;
+    seed ^= seed << 25;
+    seed ^= seed >> 27;
+    return seed * 2685821657736338717ull;
+}
+
+
+//
+// -- True with a chance of p
+//    -----------------------
+static bool Chance(double p)
+{
+    return p > 0 && (Random() >> 11) * (1.0 / 9007199254740992.0) < p;
+}
+
+
+//
+// -- Print the usage information and then exit
+//    -----------------------------------------
+static void PrintUsage(const char * const pgm)
+{
+    printf("\nUsage:\n");
+    printf("  %s [-b <baud>] [-l <ms>] [-d <rate>] [-f <rate>] [-n <rate>:<bytes>] [-r] [-s <seed>]\n"
+            "      <host-link> <rpi-link>\n", pgm);
+    printf("    -b  pass the bytes no faster than <baud> 8N1 allows (default 115200; 0 for no limit)\n");
+    printf("    -l  delay every byte by <ms> on top of its time on the line\n");
+    printf("    -d  drop each byte with a chance of <rate> (1e-4 is 1 in 10,000)\n");
+    printf("    -f  flip a bit in each byte with a chance of <rate>\n");
+    printf("    -n  start a burst of <bytes> bytes of noise at each byte with a chance of <rate>\n");
+    printf("    -r  only impair the bytes to the rpi; the answers get through clean\n");
+    printf("    -s  seed the impairments (the same seed and traffic give the same errors)\n");
+    printf("  pbl-server opens <host-link>; the loader (or a stand-in for it) opens <rpi-link>\n");
+    exit(EXIT_FAILURE);
+}
+
+
+//
+// -- Make sure the command line is well formatted
+//    --------------------------------------------
+static void ParseCommandLine(int argc, char * const argv[])
+{
+    int opt;
+    char *end;
+
+    while ((opt = getopt(argc, argv, "b:l:d:f:n:rs:")) != -1) {
+        switch (opt) {
+        case 'b':
+            baud = strtoul(optarg, &end, 10);
+            if (*end) PrintUsage(argv[0]);
+            break;
+
+        case 'l':
+            latencyMs = strtod(optarg, &end);
+            if (*end || latencyMs < 0) PrintUsage(argv[0]);
+            break;
+
+        case 'd':
+            dropRate = strtod(optarg, &end);
+            if (*end || dropRate < 0 || dropRate > 1) PrintUsage(argv[0]);
+            break;
+
+        case 'f':
+            flipRate = strtod(optarg, &end);
+            if (*end || flipRate < 0 || flipRate > 1) PrintUsage(argv[0]);
+            break;
+
+        case 'n':
+            burstRate = strtod(optarg, &end);
+            if (*end != ':' || burstRate < 0 || burstRate > 1) PrintUsage(argv[0]);
+            burstLen = strtol(end + 1, &end, 10);
+            if (*end || burstLen < 1) PrintUsage(argv[0]);
+            break;
+
+        case 'r':
+            rpiOnly = true;
+            break;
+
+        case 's':
+            seed = strtoull(optarg, &end, 0);
+            if (*end) PrintUsage(argv[0]);
+            if (!seed) seed = 1;                // -- xorshift never leaves 0
+            break;
+
+        default:
+            PrintUsage(argv[0]);
+        }
+    }
+
+    if (argc - optind != 2) PrintUsage(argv[0]);
+
+    hostLink = argv[optind];
+    rpiLink = argv[optind + 1];
+}
+
+
+//
+// -- Make a pty in raw mode with a link to it by the name given; returns the master
+//    ------------------------------------------------------------------------------
+static int OpenPty(const char *link, int *slave)
+{
+    struct termios termios;
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+
+    if (fd == -1 || grantpt(fd) == -1 || unlockpt(fd) == -1) {
+        perror("posix_openpt()");
+        exit(EXIT_FAILURE);
+    }
+
+    const char *name = ptsname(fd);
+    *slave = open(name, O_RDWR | O_NOCTTY);
+    if (*slave == -1 || tcgetattr(*slave, &termios) == -1) {
+        perror(name);
+        exit(EXIT_FAILURE);
+    }
+
+    cfmakeraw(&termios);
+    if (tcsetattr(*slave, TCSANOW, &termios) == -1 || fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
+        perror(name);
+        exit(EXIT_FAILURE);
+    }
+
+    // -- a link left behind by an earlier run is replaced
+    if (unlink(link) == -1 && errno != ENOENT) {
+        perror(link);
+        exit(EXIT_FAILURE);
+    }
+
+    if (symlink(name, link) == -1) {
+        perror(link);
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(stderr, "%s -> %s\n", link, name);
+    return fd;
+}
+
+
+//
+// -- Put a byte on the line: impair it, and work out when it comes out the other end
+//    -------------------------------------------------------------------------------
+static void Enqueue(Dir_t *d, uint8_t b, int64_t now)
+{
+    bool clean = true;
+
+    // -- 10 bits for each byte at 8N1, one after the other; a dropped byte still took its time on the line
+    const double byteUsec = (baud ? 10e6 / baud : 0);
+    d->lineFree = (d->lineFree > now ? d->lineFree : now) + byteUsec;
+
+    d->bytesIn ++;
+    if (!d->first) d->first = now;
+
+    if (d->impair) {
+        if (d->burstLeft || Chance(burstRate)) {
+            if (!d->burstLeft) {
+                d->bursts ++;
+                d->burstLeft = burstLen;
+            }
+
+            d->burstLeft --;
+            d->noise ++;
+            b = Random() & 0xff;
+            clean = false;
+        } else if (Chance(dropRate)) {
+            d->dropped ++;
+            return;
+        } else if (Chance(flipRate)) {
+            d->flipped ++;
+            b ^= 1 << (Random() & 7);
+            clean = false;
+        }
+    }
+
+    // -- then the latency
+    const uint32_t slot = d->tail % QUEUE_SIZE;
+    d->data[slot] = b;
+    d->due[slot] = (int64_t)(d->lineFree + latencyMs * 1000);
+    d->tail ++;
+
+    if (clean) d->intact ++;
+}
+
+
+//
+// -- Write the bytes that are due to the other end; returns false if the pty has gone
+//    --------------------------------------------------------------------------------
+static bool Deliver(Dir_t *d, int64_t now)
+{
+    uint8_t buf[4096];
+    uint32_t n = 0;
+
+    while (d->head + n != d->tail && n < sizeof(buf) && d->due[(d->head + n) % QUEUE_SIZE] <= now) {
+        buf[n] = d->data[(d->head + n) % QUEUE_SIZE];
+        n ++;
+    }
+
+    if (!n) return true;
+
+    ssize_t len = write(d->to, buf, n);
+    if (len == -1) {
+        if (errno == EAGAIN) return true;
+        perror(d->name);
+        return false;
+    }
+
+    d->head += len;
+    d->delivered += len;
+    d->last = now;
+    return true;
+}
+
+
+//
+// -- Report one direction of the traffic since the last report, and start counting again
+//    ------------------------------------------------------------------------------------
+static void ReportDir(Dir_t *d)
+{
+    if (!d->bytesIn) return;
+
+    const double sec = (d->last > d->first ? (d->last - d->first) / 1e6 : 1e-6);
+    const double line = baud / 10.0 / 1024;
+
+    fprintf(stderr, "  %-12s %9llu bytes in %.3f sec: %.2f KB/s raw, %.2f KB/s intact", d->name,
+            (unsigned long long)d->delivered, sec, d->delivered / sec / 1024, d->intact / sec / 1024);
+    if (baud) fprintf(stderr, " (%.1f%% of the line)", 100 * d->intact / sec / 1024 / line);
+    fprintf(stderr, "\n");
+
+    if (d->dropped || d->flipped || d->noise) {
+        fprintf(stderr, "  %-12s %llu dropped, %llu flipped, %llu garbled in %llu bursts\n", "",
+                (unsigned long long)d->dropped, (unsigned long long)d->flipped, (unsigned long long)d->noise,
+                (unsigned long long)d->bursts);
+    }
+
+    d->bytesIn = d->delivered = d->intact = d->dropped = d->flipped = d->noise = d->bursts = 0;
+    d->first = d->last = 0;
+}
+
+
+//
+// -- Report the traffic both ways since the last report
+//    --------------------------------------------------
+static void Report(void)
+{
+    if (!toRpi.bytesIn && !toHost.bytesIn) return;
+
+    fprintf(stderr, "Shim:\n");
+    ReportDir(&toRpi);
+    ReportDir(&toHost);
+}
+
+
+//
+// --  Handle the Ctrl-C to report and clean up
+//     ---------------------------------------
+static void SignalHandler(int sig)
+{
+    (void)sig;
+    quit = 1;
+}
+
+
+//
+// -- This is the main entry point: pass the bytes between the ptys until Ctrl-C
+//    --------------------------------------------------------------------------
+int main(int argc, char * const argv[])
+{
+    ParseCommandLine(argc, argv);
+
+    const int host = OpenPty(hostLink, &slaves[0]);
+    const int rpi = OpenPty(rpiLink, &slaves[1]);
+
+    toRpi.name = "to the rpi";
+    toRpi.from = host;
+    toRpi.to = rpi;
+    toRpi.impair = true;
+    toHost.name = "to the host";
+    toHost.from = rpi;
+    toHost.to = host;
+    toHost.impair = !rpiOnly;
+
+    signal(SIGINT, SignalHandler);
+    signal(SIGTERM, SignalHandler);
+
+    while (!quit) {
+        const int64_t now = NowUsec();
+        Dir_t *dirs[2] = { &toRpi, &toHost };
+        struct pollfd pfd[2] = { { .fd = host }, { .fd = rpi } };
+        int timeout = -1;
+
+        // -- read a side while its queue has room; write a side when its next byte is due (or wait for it)
+        for (int i = 0; i < 2; i ++) {
+            Dir_t *d = dirs[i];
+
+            if (d->tail - d->head < QUEUE_SIZE - 4096) pfd[i].events |= POLLIN;
+            if (d->head == d->tail) continue;
+
+            // -- round up to the ms, or poll keeps waking just before the byte is due
+            const int64_t wait = d->due[d->head % QUEUE_SIZE] - now;
+            const int waitMs = (int)((wait + 999) / 1000);
+            if (wait <= 0) pfd[1 - i].events |= POLLOUT;
+            else if (timeout == -1 || waitMs < timeout) timeout = waitMs;
+        }
+
+        if (lastActive && (timeout == -1 || timeout > REPORT_IDLE_USEC / 1000)) timeout = REPORT_IDLE_USEC / 1000;
+
+        if (poll(pfd, 2, timeout) == -1) {
+            if (errno == EINTR) continue;
+            perror("poll()");
+            break;
+        }
+
+        const int64_t t = NowUsec();
+
+        for (int i = 0; i < 2; i ++) {
+            uint8_t buf[4096];
+            Dir_t *d = dirs[i];
+
+            if (!(pfd[i].revents & POLLIN)) continue;
+
+            ssize_t len = read(pfd[i].fd, buf, sizeof(buf));
+            for (ssize_t b = 0; b < len; b ++) Enqueue(d, buf[b], t);
+            if (len > 0) lastActive = t;
+        }
+
+        if (!Deliver(&toRpi, t) || !Deliver(&toHost, t)) break;
+
+        // -- the line has gone quiet: that was a boot (or a piece of one)
+        if (lastActive && toRpi.head == toRpi.tail && toHost.head == toHost.tail
+                && t - lastActive >= REPORT_IDLE_USEC) {
+            Report();
+            lastActive = 0;
+        }
+    }
+
+    Report();
+    unlink(hostLink);
+    unlink(rpiLink);
+    return EXIT_SUCCESS;
+}